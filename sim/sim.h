@@ -0,0 +1,36 @@
+#pragma once
+// Settings and results of the native simulation, see simmain.cpp for the command line
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct SimConfig {
+  bool quiet;
+  // directory which holds the files of the simulated SD card
+  const char *sdDir;
+  // SD card latency model, in microseconds
+  uint32_t sdByteUs;       // per byte written through the SD library (print() overhead, buffer copy)
+  uint32_t sdSectorUs;     // whenever the SD library commits a full 512 byte sector
+  uint32_t sdFlushUs;      // flush() or close() of a file with unwritten data
+  uint32_t sdOpenUs;       // opening, creating or removing a file
+  uint32_t sdRawSectorUs;  // one sector of a pre-allocated logfile
+  // AVG and CT index (0..7, the CT for bus and shunt) used instead of the values the firmware
+  // asks for; -1 = no override
+  int forceAvg;
+  int forceCt;
+  // file which receives the Serial output instead of stdout, e.g. for tools/streamrecv.cpp
+  FILE *serialOut;
+  // the RTC runs this much faster than the MCU clock, in parts per million (negative: slower)
+  int32_t rtcPpm;
+  // the SQW/OUT pin of the RTC is connected
+  bool rtcSquareWave;
+};
+extern SimConfig simConfig;
+
+// loads the waveform the simulated INA226 plays back: a CSV file with lines
+// "seconds,bus_V,current_mA", linearly interpolated and repeated after the last line
+bool simLoadWaveform(const char *filename);
+
+// AVG and CT values of the index 0..7, as in the INA226 datasheet
+extern const unsigned int SIM_AVG_VALUES[8];
+extern const unsigned int SIM_CT_VALUES[8];
@@ -0,0 +1,188 @@
+#include "simcore.h"
+#include "sim.h"
+
+SimSerial Serial;
+
+static uint64_t now;
+// time spent by the running event handler, 0 outside of handlers
+static bool inHandler;
+static uint64_t handlerTime;
+
+struct SimEvent {
+  SimEventHandler handler;
+  uint64_t at;
+};
+static SimEvent events[8];
+static int eventCount;
+
+uint64_t simNow() { return now; }
+
+// time the millis() timer stood still, and since when if it does now
+static uint64_t timerStopped;
+static bool stopped;
+static uint64_t stoppedAt;
+
+void simStopTimer(bool stop) {
+  if (stop && !stopped) {
+    stoppedAt = now;
+  }
+  else if (!stop && stopped) {
+    timerStopped += now - stoppedAt;
+  }
+  stopped = stop;
+}
+
+bool simTimerStopped() { return stopped; }
+
+static uint64_t timerNow() { return (stopped ? stoppedAt : now) - timerStopped; }
+
+void simSchedule(SimEventHandler handler, uint64_t at) {
+  simCancel(handler);
+  if (eventCount < (int)(sizeof(events) / sizeof(events[0]))) {
+    events[eventCount].handler = handler;
+    events[eventCount].at = at;
+    eventCount++;
+  }
+}
+
+void simCancel(SimEventHandler handler) {
+  for (int i = 0; i < eventCount; i++) {
+    if (events[i].handler == handler) {
+      events[i] = events[--eventCount];
+      return;
+    }
+  }
+}
+
+// removes and returns the earliest event due at or before the given time
+static bool nextEvent(uint64_t until, SimEvent &event) {
+  int best = -1;
+  for (int i = 0; i < eventCount; i++) {
+    if (events[i].at <= until && (best < 0 || events[i].at < events[best].at)) {
+      best = i;
+    }
+  }
+  if (best < 0) {
+    return false;
+  }
+  event = events[best];
+  events[best] = events[--eventCount];
+  return true;
+}
+
+static void runEvent(const SimEvent &event, uint64_t &target) {
+  if (event.at > now) {
+    now = event.at;
+  }
+  inHandler = true;
+  handlerTime = 0;
+  event.handler();
+  inHandler = false;
+  // the interrupted code continues after the handler
+  now += handlerTime;
+  target += handlerTime;
+}
+
+void simAdvance(uint64_t us) {
+  if (inHandler) {
+    handlerTime += us;
+    return;
+  }
+  uint64_t target = now + us;
+  SimEvent event;
+  while (nextEvent(target, event)) {
+    runEvent(event, target);
+  }
+  now = target;
+}
+
+bool simIdle() {
+  if (eventCount == 0) {
+    return false;
+  }
+  SimEvent event;
+  uint64_t target = UINT64_MAX;
+  nextEvent(target, event);
+  target = event.at;
+  runEvent(event, target);
+  return true;
+}
+
+unsigned long millis() { return (unsigned long)(timerNow() / 1000); }
+unsigned long micros() { return (unsigned long)timerNow(); }
+void delay(unsigned long ms) { simAdvance((uint64_t)ms * 1000); }
+void delayMicroseconds(unsigned int us) { simAdvance(us); }
+void noInterrupts() {}
+void interrupts() {}
+
+String::String(const char *s) { snprintf(buffer, sizeof(buffer), "%s", s); }
+String::String(int value) { snprintf(buffer, sizeof(buffer), "%d", value); }
+String::String(unsigned int value) { snprintf(buffer, sizeof(buffer), "%u", value); }
+String::String(long value) { snprintf(buffer, sizeof(buffer), "%ld", value); }
+String::String(unsigned long value) { snprintf(buffer, sizeof(buffer), "%lu", value); }
+String::String(double value, unsigned char decimals) { snprintf(buffer, sizeof(buffer), "%.*f", decimals, value); }
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::print(long value, int base) {
+  if (base == DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    return write(buf);
+  }
+  return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+  char buf[40];
+  char *p = buf + sizeof(buf) - 1;
+  *p = '\0';
+  do {
+    unsigned digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value);
+  return write(p);
+}
+
+size_t Print::print(double value, int digits) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", digits, value);
+  return write(buf);
+}
+
+size_t SimSerial::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+const int SERIAL_TX_BUFFER = 64;
+
+int SimSerial::availableForWrite() {
+  uint64_t now = simNow() * 1000;
+  if (idleAtNanos <= now) {
+    return SERIAL_TX_BUFFER;
+  }
+  int pending = (idleAtNanos - now + byteNanos - 1) / byteNanos;
+  return pending < SERIAL_TX_BUFFER ? SERIAL_TX_BUFFER - pending : 0;
+}
+
+size_t SimSerial::write(const uint8_t *buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (availableForWrite() == 0) {
+      // wait until the oldest byte is out
+      simAdvance((idleAtNanos - (SERIAL_TX_BUFFER - 1) * byteNanos) / 1000 + 1 - simNow());
+    }
+    uint64_t now = simNow() * 1000;
+    idleAtNanos = (idleAtNanos > now ? idleAtNanos : now) + byteNanos;
+  }
+  if (!simConfig.quiet) {
+    fwrite(buffer, 1, size, simConfig.serialOut ? simConfig.serialOut : stdout);
+  }
+  return size;
+}
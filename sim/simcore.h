@@ -0,0 +1,145 @@
+#pragma once
+// Arduino core subset for the native build, running on a deterministic virtual clock
+//
+// millis(), micros() and delay() read and advance the virtual clock; nothing ever sleeps.
+// Simulated interrupts are events on the virtual clock: when the clock advances past an
+// event, its handler runs, and the time the handler spends (e.g. on the simulated I2C bus)
+// is added to the code it interrupted, as on the real MCU.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <cmath>
+
+using std::abs;
+
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte_near(a) (*(const uint8_t *)(a))
+#define pgm_read_word_near(a) (*(const uint16_t *)(a))
+#define pgm_read_dword_near(a) (*(const uint32_t *)(a))
+#define snprintf_P snprintf
+
+template <class T, class L>
+auto min(const T &a, const L &b) -> decltype((b < a) ? b : a) { return (b < a) ? b : a; }
+template <class T, class L>
+auto max(const T &a, const L &b) -> decltype((b < a) ? b : a) { return (a < b) ? b : a; }
+
+// virtual clock
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void noInterrupts();
+void interrupts();
+
+// F() strings are plain strings here
+class __FlashStringHelper;
+
+class String {
+public:
+  String(const char *s = "");
+  String(int value);
+  String(unsigned int value);
+  String(long value);
+  String(unsigned long value);
+  String(double value, unsigned char decimals = 2);
+  const char *c_str() const { return buffer; }
+  unsigned int length() const { return strlen(buffer); }
+
+private:
+  char buffer[48];
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+
+  size_t print(const char *str) { return write(str); }
+  size_t print(const __FlashStringHelper *str) { return write((const char *)str); }
+  size_t print(const String &str) { return write(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value, int base = DEC) { return print((long)value, base); }
+  size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T value) { size_t n = print(value); return n + println(); }
+  template <typename T>
+  size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+// Serial goes to stdout or simConfig.serialOut, unless the simulation runs quietly; nothing is
+// ever received. Like the UART of the Nano Every it sends 10 bits per byte at the baud rate from
+// a 64 byte transmit buffer, and write() waits while the buffer is full.
+class SimSerial : public Print {
+public:
+  void begin(unsigned long baud) { byteNanos = 10000000000ULL / baud; }
+  int available() { return 0; }
+  int read() { return -1; }
+  int availableForWrite();
+  operator bool() const { return true; }
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+private:
+  uint64_t byteNanos = 10000000000ULL / 460800;
+  // virtual time in nanoseconds when the last byte in the buffer has been sent
+  uint64_t idleAtNanos = 0;
+};
+extern SimSerial Serial;
+
+// files of the simulated SD card, see simperipherals.cpp
+#define FILE_READ 0x01
+#define FILE_WRITE 0x13
+
+class File : public Print {
+public:
+  File() {}
+  File(FILE *fp, bool writing) : fp(fp), writing(writing) {}
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  int available();
+  int read();
+  uint32_t size();
+  void flush();
+  void close();
+  operator bool() const { return fp != NULL; }
+
+private:
+  FILE *fp = NULL;
+  bool writing = false;
+  // bytes written so far, the SD library commits a sector every 512 bytes
+  uint32_t written = 0;
+  bool dirty = false;
+};
+
+// virtual clock and simulated interrupts
+typedef void (*SimEventHandler)();
+uint64_t simNow();
+// advances the clock, running the events which become due in the meantime; called from
+// within an event handler, the time is added to the interrupted code instead
+void simAdvance(uint64_t us);
+// (re)schedules the handler at an absolute time; each handler has at most one pending event
+void simSchedule(SimEventHandler handler, uint64_t at);
+void simCancel(SimEventHandler handler);
+// stops or restarts the millis() timer, as the STANDBY sleep of the MCU does; the virtual clock
+// and the events go on
+void simStopTimer(bool stop);
+bool simTimerStopped();
+// advances the clock to the next event and runs it; false if no event is pending
+bool simIdle();
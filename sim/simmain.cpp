@@ -0,0 +1,383 @@
+// Native build of the logger: runs setup() and loop() of main.cpp against the simulated
+// peripherals on a virtual clock, or benchmarks the sustainable sample rate
+//
+//   program [options]               run the logger, the logfiles go to --sd-dir
+//   program --bench [options]       max. sustainable rate for every AVG/CT combination
+//   program --check-csv             CSV rows against the float values the logger used to print
+//
+// See usage() for the options.
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "csvrow.h"
+#include "hal.h"
+#include "sampler.h"
+#include "sim.h"
+
+void setup();
+void loop();
+// from main.cpp
+extern bool logging;
+extern unsigned long overruns;
+
+struct RunOptions {
+  double freq = 10.0;
+  int mode = 0;
+  int format = 0;
+  int preallocMB = 0;
+  int catchUpPolicy = 0;
+  int shuntWeight = 0;
+  int aggregation = 0;
+  const char *channels = "0x40";
+  int triggerPolicy = 0;
+  int pretriggerSamples = 0;
+  int serialStream = 0;
+  int sdBenchmark = 0;
+  int lowPowerStandby = 0;
+  double burstFreq = 0.0;
+  int burstHoldMillis = 1000;
+  double burstCurrentStep = 0.0;
+  double burstVoltageStep = 0.0;
+  double voltageThreshold = 0.0;
+  double currentThreshold = 0.0;
+  double seconds = 10.0;
+};
+
+static void usage() {
+  fprintf(stderr,
+    "usage: program [options]\n"
+    "  --freq HZ          measurement frequency (LOGGER.INI line 2), default 10\n"
+    "  --mode N           acquisition mode 0, 1 or 2 (LOGGER.INI line 6), default 0\n"
+    "  --format N         log format 0 = CSV, 1 = binary, 2 = delta encoded binary\n"
+    "                     (LOGGER.INI line 5), default 0\n"
+    "  --prealloc MB      size of pre-allocated logfiles (LOGGER.INI line 7), default 0\n"
+    "  --catch-up N       catch-up policy 0 = skip, 1 = burst (LOGGER.INI line 8), default 0\n"
+    "  --shunt-weight N   weight of the shunt CT, 0 = same CT for bus and shunt\n"
+    "                     (LOGGER.INI line 9), default 0\n"
+    "  --aggregate N      1 = one min/mean/max/RMS row per 1/freq (LOGGER.INI line 10), default 0\n"
+    "  --channels LIST    I2C addresses of the INA226 devices, e.g. \"0x40,0x41\"; channel k\n"
+    "                     sees the current divided by k+1 (LOGGER.INI line 13), default 0x40\n"
+    "  --trigger N        thresholds met on 0 = any channel, 1 = all channels\n"
+    "                     (LOGGER.INI line 14), default 0\n"
+    "  --pretrigger N     samples of the standby written ahead of the trigger (LOGGER.INI\n"
+    "                     line 15), default 0\n"
+    "  --stream N         serial output 0 = text, 1 = binary frames (LOGGER.INI line 16), default 0\n"
+    "  --serial-out FILE  write the serial output to FILE instead of stdout\n"
+    "  --voltage-threshold V, --current-threshold MA\n"
+    "                     logging thresholds (LOGGER.INI lines 3 and 4), default 0 = always log\n"
+    "  --seconds S        virtual time measured, starting 0.5s after logging started, default 10\n"
+    "  --waveform FILE    CSV file with lines \"seconds,bus_V,current_mA\"\n"
+    "  --sd-dir DIR       directory of the simulated SD card, default simsd\n"
+    "  --sd-byte US       SD latency per byte written, default 60\n"
+    "  --sd-sector US     SD latency per committed sector, default 6500\n"
+    "  --sd-flush US      SD latency per flush, default 5000\n"
+    "  --sd-open US       SD latency per open/create/remove, default 20000\n"
+    "  --sd-raw US        SD latency per sector of a pre-allocated logfile, default 1500\n"
+    "  --avg N --ct N     AVG and CT index 0..7 used instead of the firmware's choice\n"
+    "  --rtc-ppm N        the RTC runs N ppm faster than the MCU clock (negative: slower), default 0\n"
+    "  --no-sqw           the SQW/OUT pin of the RTC is not connected\n"
+    "  --sd-bench N       1 = benchmark the SD card at power-up, see SDBENCH.TXT\n"
+    "  --low-power N      1 = sleep in standby until the INA226 alert trips\n"
+    "  --burst-freq HZ    adaptive sampling rate: frequency of a burst, default 0 = off\n"
+    "  --burst-hold MS    a burst lasts until no step was seen for MS milliseconds, default 1000\n"
+    "  --burst-current MA --burst-voltage V  current and bus voltage steps which start a burst\n"
+    "  --bench            find the max. sustainable rate for every AVG/CT combination\n"
+    "  --min-rate HZ      with --bench: fail unless every combination which converts at\n"
+    "                     least HZ times per second sustains HZ, default 0 (report only)\n"
+    "  --check-csv        compare csvWriteRow() with String(value, 5) of the float values\n"
+    "  --quiet            no serial output\n");
+  exit(2);
+}
+
+// removes the INI file and the logfiles of previous runs
+static void clearSdDir() {
+  DIR *dir = opendir(simConfig.sdDir);
+  if (!dir) {
+    return;
+  }
+  struct dirent *entry;
+  char path[512];
+  while ((entry = readdir(dir))) {
+    const char *ext = strrchr(entry->d_name, '.');
+    bool logfile = strncmp(entry->d_name, "log", 3) == 0 && ext && (!strcmp(ext, ".csv") || !strcmp(ext, ".bin"));
+    if (logfile || !strcmp(entry->d_name, "LOGGER.INI")) {
+      snprintf(path, sizeof(path), "%s/%s", simConfig.sdDir, entry->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+}
+
+static bool writeIni(const RunOptions &opt) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/LOGGER.INI", simConfig.sdDir);
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    return false;
+  }
+  // iter, freq, bus voltage and current threshold, format, mode, prealloc, catch-up policy, shunt weight,
+  // aggregation, charge and energy totals, channels, trigger policy, pre-trigger samples, serial stream,
+  // SD card benchmark, low-power standby, burst frequency, hold time, current and voltage step
+  fprintf(fp, "0\r\n%.10f\r\n%.10f\r\n%.10f\r\n%d\r\n%d\r\n%d\r\n%d\r\n%d\r\n%d\r\n0\r\n0\r\n%s\r\n%d\r\n%d\r\n%d\r\n%d\r\n%d\r\n"
+              "%.10f\r\n%d\r\n%.10f\r\n%.10f\r\n",
+          opt.freq, opt.voltageThreshold, opt.currentThreshold, opt.format, opt.mode, opt.preallocMB,
+          opt.catchUpPolicy, opt.shuntWeight, opt.aggregation, opt.channels, opt.triggerPolicy,
+          opt.pretriggerSamples, opt.serialStream, opt.sdBenchmark,
+          opt.lowPowerStandby, opt.burstFreq, opt.burstHoldMillis, opt.burstCurrentStep, opt.burstVoltageStep);
+  fclose(fp);
+  return true;
+}
+
+// the measurement starts this long after logging started, so opening the first logfile
+// and the backlog of samples it causes are not part of it
+const uint64_t SETTLE_MICROS = 500000;
+
+static uint64_t measureMicros;
+static bool benchChild;
+
+// samples which were late (mode 0) or lost (modes 1 and 2) since the measurement started
+static unsigned long lostSamples() {
+  return overruns + samplerOverflows() + samplerLateTicks();
+}
+
+// loop() does not necessarily return, e.g. if the sample buffer never runs empty, so the
+// measurement is started and ended by events on the virtual clock
+static void endMeasurement() {
+  if (benchChild) {
+    exit(lostSamples() ? 1 : 0);
+  }
+  printf("\n%lu late or lost samples in %.1f seconds (overruns %lu, buffer overflows %u, late conversions %u)\n",
+         lostSamples(), measureMicros / 1e6, overruns, samplerOverflows(), samplerLateTicks());
+  exit(0);
+}
+
+static void startMeasurement() {
+  overruns = 0;
+  samplerResetCounters();
+  simSchedule(endMeasurement, simNow() + measureMicros);
+}
+
+static void waitForLogging() {
+  if (logging) {
+    simSchedule(startMeasurement, simNow() + SETTLE_MICROS);
+  }
+  else {
+    simSchedule(waitForLogging, simNow() + 10000);
+  }
+}
+
+// runs the logger for opt.seconds after logging started, the process exits at the end
+static void run(const RunOptions &opt) {
+  storageBegin(0);
+  clearSdDir();
+  if (!writeIni(opt)) {
+    fprintf(stderr, "can not write LOGGER.INI to %s\n", simConfig.sdDir);
+    exit(2);
+  }
+  measureMicros = opt.seconds * 1e6;
+  setup();
+  simSchedule(waitForLogging, simNow());
+  for (;;) {
+    uint64_t before = simNow();
+    loop();
+    if (simNow() == before) {
+      simIdle();
+    }
+  }
+}
+
+// runs one point in a child process, so every run starts with the initial values of the
+// firmware's globals; true if no sample was late or lost
+static bool sustained(const RunOptions &opt) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    simConfig.quiet = true;
+    benchChild = true;
+    run(opt);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int bench(RunOptions opt, double minRate) {
+  int failed = 0;
+
+  printf("mode %d, format %d, prealloc %d MB\n", opt.mode, opt.format, opt.preallocMB);
+  printf("  AVG    CT  conversion[us]  max rate[Hz]  of conversion rate\n");
+  for (int a = 0; a < 8; a++) {
+    for (int c = 0; c < 8; c++) {
+      simConfig.forceAvg = a;
+      simConfig.forceCt = c;
+      double period = (double)SIM_AVG_VALUES[a] * 2 * SIM_CT_VALUES[c];
+      double conversionRate = 1e6 / period;
+      // at least 100 samples for every combination
+      double seconds = opt.seconds;
+      opt.freq = conversionRate;
+      opt.seconds = max(seconds, 100.0 / opt.freq);
+      double best = 0.0;
+      if (sustained(opt)) {
+        best = conversionRate;
+      }
+      else if (opt.mode != 2) {
+        // in mode 2 the INA226 paces the samples, there is no rate to choose; otherwise
+        // bisect down to 1/1024 of the conversion rate
+        double lo = 0.0, hi = conversionRate;
+        for (int i = 0; i < 10; i++) {
+          opt.freq = (lo + hi) / 2;
+          opt.seconds = max(seconds, 100.0 / opt.freq);
+          if (sustained(opt)) {
+            lo = opt.freq;
+          }
+          else {
+            hi = opt.freq;
+          }
+        }
+        best = lo;
+      }
+      opt.seconds = seconds;
+      bool pass = conversionRate < minRate || best >= minRate;
+      failed += !pass;
+      printf("%5u %5u %15.0f %13.3f %18.0f%%%s\n", SIM_AVG_VALUES[a], SIM_CT_VALUES[c], period, best,
+             100.0 * best / conversionRate, pass ? "" : "  FAIL");
+    }
+  }
+  if (minRate > 0.0) {
+    printf("%s: %d combination(s) can not sustain %.3f Hz\n", failed ? "FAIL" : "PASS", failed, minRate);
+  }
+  return failed ? 1 : 0;
+}
+
+// a row of csvWriteRow()
+class RowText : public Print {
+public:
+  size_t write(uint8_t b) override {
+    if (length < sizeof(text) - 1) {
+      text[length++] = b;
+      text[length] = 0;
+    }
+    return 1;
+  }
+  using Print::write;
+  char text[256];
+  size_t length = 0;
+};
+
+// appends the columns of one channel as scaleSample() calculated them in 32 bit floats and
+// the logger printed them with String(value, 5)
+static void appendFloatValues(char *row, const ChannelSample &c, float currentLSB_mA) {
+  float loadVoltage_V = (float)loadVoltageRaw(c) * 2.5e-6f;
+  float current_mA = (float)-c.currentRaw * currentLSB_mA;
+  float power_mW = (float)c.powerRaw * 25.0f * currentLSB_mA;
+  sprintf(row + strlen(row), ",%s,%s,%s", String(loadVoltage_V, 5).c_str(), String(current_mA, 5).c_str(),
+          String(power_mW, 5).c_str());
+}
+
+// sweeps every value of each register through csvWriteRow(), for the current LSB of the logger
+// and one with all mantissa bits in use, and compares the rows without time_s with the text of
+// the float calculation
+static int checkCsv() {
+  const float lsbs[] = { 20.0f * 1000.0f / 32768.0f, 0.1f };
+  unsigned long rows = 0, failed = 0;
+  for (float lsb : lsbs) {
+    csvRowBegin(lsb, 3);
+    for (uint32_t v = 0; v < 65536; v++) {
+      uint16_t mixed = v * 40503;
+      Sample s;
+      memset(&s, 0, sizeof(s));
+      s.millis = v * 3;
+      s.micros = v * 2999;
+      s.flags = v & 1;
+      s.ch[0] = { (uint16_t)v, (int16_t)mixed, (int16_t)v, (uint16_t)v };
+      s.ch[1] = { 0, (int16_t)v, (int16_t)mixed, mixed };
+      s.ch[2] = { 28800, (int16_t)v, (int16_t)(mixed ^ 0x8000), (uint16_t)(mixed ^ 0x8000) };
+      RowText row;
+      csvWriteRow(row, s);
+      *strrchr(row.text, ',') = 0;
+      char expected[256];
+      sprintf(expected, "%lu,%lu,%s", s.millis, s.micros, s.flags ? "overflow" : "ok");
+      for (byte ch = 0; ch < 3; ch++) {
+        appendFloatValues(expected, s.ch[ch], lsb);
+      }
+      rows++;
+      if (strcmp(row.text, expected)) {
+        if (!failed) {
+          printf("current LSB %.9g mA\n  csvWriteRow: %s\n  float:       %s\n", lsb, row.text, expected);
+        }
+        failed++;
+      }
+    }
+  }
+  printf("%s: %lu of %lu rows differ\n", failed ? "FAIL" : "PASS", failed, rows);
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  RunOptions opt;
+  bool benchmark = false;
+  double minRate = 0.0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!strcmp(arg, "--bench")) { benchmark = true; continue; }
+    if (!strcmp(arg, "--check-csv")) { return checkCsv(); }
+    if (!strcmp(arg, "--quiet")) { simConfig.quiet = true; continue; }
+    if (!strcmp(arg, "--no-sqw")) { simConfig.rtcSquareWave = false; continue; }
+    if (!value) { usage(); }
+    i++;
+    if (!strcmp(arg, "--freq")) opt.freq = atof(value);
+    else if (!strcmp(arg, "--mode")) opt.mode = atoi(value);
+    else if (!strcmp(arg, "--format")) opt.format = atoi(value);
+    else if (!strcmp(arg, "--prealloc")) opt.preallocMB = atoi(value);
+    else if (!strcmp(arg, "--catch-up")) opt.catchUpPolicy = atoi(value);
+    else if (!strcmp(arg, "--shunt-weight")) opt.shuntWeight = atoi(value);
+    else if (!strcmp(arg, "--aggregate")) opt.aggregation = atoi(value);
+    else if (!strcmp(arg, "--channels")) opt.channels = value;
+    else if (!strcmp(arg, "--trigger")) opt.triggerPolicy = atoi(value);
+    else if (!strcmp(arg, "--pretrigger")) opt.pretriggerSamples = atoi(value);
+    else if (!strcmp(arg, "--stream")) opt.serialStream = atoi(value);
+    else if (!strcmp(arg, "--sd-bench")) opt.sdBenchmark = atoi(value);
+    else if (!strcmp(arg, "--low-power")) opt.lowPowerStandby = atoi(value);
+    else if (!strcmp(arg, "--burst-freq")) opt.burstFreq = atof(value);
+    else if (!strcmp(arg, "--burst-hold")) opt.burstHoldMillis = atoi(value);
+    else if (!strcmp(arg, "--burst-current")) opt.burstCurrentStep = atof(value);
+    else if (!strcmp(arg, "--burst-voltage")) opt.burstVoltageStep = atof(value);
+    else if (!strcmp(arg, "--serial-out")) {
+      simConfig.serialOut = fopen(value, "wb");
+      if (!simConfig.serialOut) {
+        perror(value);
+        return 2;
+      }
+    }
+    else if (!strcmp(arg, "--voltage-threshold")) opt.voltageThreshold = atof(value);
+    else if (!strcmp(arg, "--current-threshold")) opt.currentThreshold = atof(value);
+    else if (!strcmp(arg, "--seconds")) opt.seconds = atof(value);
+    else if (!strcmp(arg, "--sd-dir")) simConfig.sdDir = value;
+    else if (!strcmp(arg, "--sd-byte")) simConfig.sdByteUs = atol(value);
+    else if (!strcmp(arg, "--sd-sector")) simConfig.sdSectorUs = atol(value);
+    else if (!strcmp(arg, "--sd-flush")) simConfig.sdFlushUs = atol(value);
+    else if (!strcmp(arg, "--sd-open")) simConfig.sdOpenUs = atol(value);
+    else if (!strcmp(arg, "--sd-raw")) simConfig.sdRawSectorUs = atol(value);
+    else if (!strcmp(arg, "--avg")) simConfig.forceAvg = atoi(value) & 7;
+    else if (!strcmp(arg, "--ct")) simConfig.forceCt = atoi(value) & 7;
+    else if (!strcmp(arg, "--min-rate")) minRate = atof(value);
+    else if (!strcmp(arg, "--rtc-ppm")) simConfig.rtcPpm = atol(value);
+    else if (!strcmp(arg, "--waveform")) {
+      if (!simLoadWaveform(value)) {
+        fprintf(stderr, "can not read waveform %s\n", value);
+        return 2;
+      }
+    }
+    else usage();
+  }
+  if (opt.freq <= 0.0 || opt.mode < 0 || opt.mode > 2) {
+    usage();
+  }
+
+  if (benchmark) {
+    return bench(opt, minRate);
+  }
+  run(opt);
+}
@@ -0,0 +1,599 @@
+// Simulated INA226, SD card and DS1307 for the native build; implements hal.h and sampler.h
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "hal.h"
+#include "sampler.h"
+#include "sim.h"
+
+SimConfig simConfig = {
+  false,   // quiet
+  "simsd", // sdDir
+  60,      // sdByteUs
+  6500,    // sdSectorUs
+  5000,    // sdFlushUs
+  20000,   // sdOpenUs
+  1500,    // sdRawSectorUs
+  -1,      // forceAvg
+  -1,      // forceCt
+  NULL,    // serialOut
+  0,       // rtcPpm
+  true,    // rtcSquareWave
+};
+
+const unsigned int SIM_AVG_VALUES[8] = {1, 4, 16, 64, 128, 256, 512, 1024};
+const unsigned int SIM_CT_VALUES[8] = {140, 204, 332, 588, 1100, 2116, 4156, 8244};
+
+// ---- waveform
+
+struct WavePoint {
+  double seconds;
+  double busVoltage_V;
+  double current_mA;
+};
+
+// a 12V source with a 1A load and some ripple, if no waveform file is given
+static std::vector<WavePoint> waveform = {
+  {0.0, 12.00, 1000.0},
+  {0.5, 11.95, 1100.0},
+  {1.0, 12.00, 1000.0},
+};
+
+bool simLoadWaveform(const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    return false;
+  }
+  std::vector<WavePoint> points;
+  char line[128];
+  while (fgets(line, sizeof(line), fp)) {
+    WavePoint p;
+    if (sscanf(line, "%lf,%lf,%lf", &p.seconds, &p.busVoltage_V, &p.current_mA) == 3) {
+      points.push_back(p);
+    }
+  }
+  fclose(fp);
+  if (points.size() < 2) {
+    return false;
+  }
+  waveform = points;
+  return true;
+}
+
+static WavePoint waveAt(uint64_t us) {
+  double length = waveform.back().seconds - waveform.front().seconds;
+  double t = waveform.front().seconds + fmod(us / 1e6, length);
+  size_t i = 1;
+  while (i < waveform.size() - 1 && waveform[i].seconds < t) {
+    i++;
+  }
+  const WavePoint &a = waveform[i - 1];
+  const WavePoint &b = waveform[i];
+  double f = b.seconds > a.seconds ? (t - a.seconds) / (b.seconds - a.seconds) : 0.0;
+  f = f < 0.0 ? 0.0 : (f > 1.0 ? 1.0 : f);
+  WavePoint p;
+  p.seconds = t;
+  p.busVoltage_V = a.busVoltage_V + f * (b.busVoltage_V - a.busVoltage_V);
+  p.current_mA = a.current_mA + f * (b.current_mA - a.current_mA);
+  return p;
+}
+
+// ---- INA226
+
+static float shuntResistor = 0.002;
+static float currentLSB_mA = 20000.0 / 32768.0;
+// the calibration register setResistorRange() writes
+static uint16_t calibration = 2048;
+static int avgIndex = 0;
+static int ctShuntIndex = 4;
+static int ctBusIndex = 4;
+static unsigned long i2cHz = 100000;
+// number of INA226 devices; channel k sees the waveform current divided by k+1
+static byte channelCount = 1;
+
+static uint64_t conversionMicros() {
+  return (uint64_t)SIM_AVG_VALUES[avgIndex] * (SIM_CT_VALUES[ctShuntIndex] + SIM_CT_VALUES[ctBusIndex]);
+}
+
+// a register read is start, address, register, repeated start, address and two data bytes,
+// a register write start, address, register and two data bytes; 9 clocks per byte
+static void i2cRead() { simAdvance(47 * 1000000UL / i2cHz); }
+static void i2cWrite() { simAdvance(38 * 1000000UL / i2cHz); }
+// the same transaction on every device
+static void i2cWriteAll() {
+  for (byte i = 0; i < channelCount; i++) {
+    i2cWrite();
+  }
+}
+
+static long clampRegister(double value, long lo, long hi) {
+  long v = lround(value);
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// the INA226 averages over the whole conversion; the sign convention is the one of the
+// "red" module, i.e. the firmware negates the current
+static void convert(uint64_t from, uint64_t to, Sample &s) {
+  const int points = 16;
+  double bus = 0.0, current = 0.0;
+  for (int i = 0; i < points; i++) {
+    WavePoint p = waveAt(from + (to - from) * (i + 1) / points);
+    bus += p.busVoltage_V / points;
+    current += p.current_mA / points;
+  }
+  s.flags = 0;
+  for (byte k = 0; k < channelCount; k++) {
+    ChannelSample &c = s.ch[k];
+    double channelCurrent = current / (k + 1);
+    double shunt_mV = channelCurrent * shuntResistor;
+    c.busRaw = clampRegister(bus / 0.00125, 0, 65535);
+    c.shuntRaw = clampRegister(-shunt_mV / 0.0025, -32768, 32767);
+    if (!deriveCurrentPower(c, calibration) || fabs(shunt_mV) > 81.92) {
+      s.flags |= SAMPLE_OVERFLOW << k;
+    }
+  }
+}
+
+void sensorBegin(const byte *, byte channels, float resistor, float currentRange, float) {
+  channelCount = channels;
+  shuntResistor = resistor;
+  currentLSB_mA = currentRange * 1000.0 / 32768.0;
+  calibration = lround(0.00512 / (currentLSB_mA / 1000.0 * shuntResistor));
+  // init, calibration, correction factor, flags, calibration read back
+  for (byte i = 0; i < channelCount; i++) {
+    i2cWrite();
+    i2cWrite();
+    i2cWrite();
+    i2cRead();
+    i2cRead();
+  }
+  i2cHz = 400000;
+}
+
+void sensorConfigure(averageMode avg, convTime ctShunt, convTime ctBus) {
+  avgIndex = simConfig.forceAvg >= 0 ? simConfig.forceAvg : (avg >> 9);
+  ctShuntIndex = simConfig.forceCt >= 0 ? simConfig.forceCt : ctShunt;
+  ctBusIndex = simConfig.forceCt >= 0 ? simConfig.forceCt : ctBus;
+  i2cWriteAll();
+  i2cWriteAll();
+  // configuration register read back
+  i2cRead();
+}
+
+void sensorStartTriggered() {
+  i2cWriteAll();
+}
+
+void sensorStartContinuous() {
+  i2cWriteAll();
+  i2cWriteAll();
+  i2cWriteAll();
+}
+
+void sensorAcquire(Sample &s) {
+  // the configuration register of every device triggers a conversion, then the Mask/Enable
+  // register of the first one is polled; the others started later and are polled as well
+  i2cWriteAll();
+  uint64_t start = simNow();
+  simAdvance(conversionMicros());
+  i2cRead();
+  uint64_t end = simNow();
+  s.millis = millis();
+  s.micros = micros();
+  convert(start, end, s);
+  // shunt and bus register of every device, Mask/Enable of the others
+  for (int i = 0; i < 2 + 3 * (channelCount - 1); i++) {
+    i2cRead();
+  }
+}
+
+// true if a conversion of the first device trips the alert function
+static bool alertTripped(uint16_t function, uint16_t limit, const ChannelSample &c) {
+  switch (function) {
+    case ALERT_SHUNT_OVER: return c.shuntRaw > (int16_t)limit;
+    case ALERT_SHUNT_UNDER: return c.shuntRaw < (int16_t)limit;
+    case ALERT_BUS_OVER: return c.busRaw > limit;
+    case ALERT_POWER_OVER: return c.powerRaw > limit;
+  }
+  return false;
+}
+
+void sensorSleepUntilAlert(uint16_t function, uint16_t limit, byte) {
+  // the other devices powered down, alert limit, Mask/Enable and configuration register
+  for (byte i = 0; i < channelCount + 2; i++) {
+    i2cWrite();
+  }
+  uint64_t period = SIM_AVG_VALUES[avgIndex];
+  if (function & (ALERT_SHUNT_OVER | ALERT_SHUNT_UNDER)) {
+    period *= SIM_CT_VALUES[ctShuntIndex];
+  }
+  else if (function & ALERT_BUS_OVER) {
+    period *= SIM_CT_VALUES[ctBusIndex];
+  }
+  else {
+    period = conversionMicros();
+  }
+  // the MCU sleeps in STANDBY while the first device converts; millis() stands still
+  Sample s;
+  simStopTimer(true);
+  do {
+    uint64_t start = simNow();
+    simAdvance(period);
+    convert(start, simNow(), s);
+  } while (!alertTripped(function, limit, s.ch[0]));
+  simStopTimer(false);
+  // Mask/Enable cleared and read
+  i2cWrite();
+  i2cRead();
+}
+
+// ---- sampler, i.e. the timer and ALERT interrupts of sampler.cpp
+
+RingBuffer<Sample, SAMPLE_BUFFER_SIZE> sampleBuffer;
+
+static bool running;
+static bool continuous;
+static bool suspended;
+static bool pending;
+static bool primed;
+static unsigned long period;
+static uint64_t nextEventAt;
+static uint64_t conversionStart;
+static uint64_t conversionEnd;
+// the last conversion finished in CONTINUOUS mode
+static uint64_t readyStart;
+static uint64_t readyEnd;
+static unsigned int lateTicks;
+
+// reads the result of the conversion from start to end; the INA226 has not finished it
+// yet if the interrupt comes too early
+static void readConversion(uint64_t start, uint64_t end) {
+  Sample s;
+  s.millis = millis();
+  s.micros = micros();
+  i2cRead();
+  if (simNow() < end) {
+    lateTicks++;
+    return;
+  }
+  convert(start, end, s);
+  // shunt and bus register of the first device, Mask/Enable and the registers of the others
+  for (int i = 0; i < 2 + 3 * (channelCount - 1); i++) {
+    i2cRead();
+  }
+  sampleBuffer.push(s);
+}
+
+// timer interrupt: reads the previous conversion and triggers the next one
+static void timerTick() {
+  if (primed) {
+    readConversion(conversionStart, conversionEnd);
+  }
+  i2cWriteAll();
+  conversionStart = simNow();
+  conversionEnd = conversionStart + conversionMicros();
+  primed = true;
+}
+
+static void timerHandler() {
+  if (suspended) {
+    pending = true;
+  }
+  else {
+    timerTick();
+  }
+  nextEventAt += period;
+  simSchedule(timerHandler, nextEventAt);
+}
+
+// ALERT interrupt: in CONTINUOUS mode the next conversion starts right after the previous one;
+// the latched ALERT of a conversion finished while suspended is serviced by samplerResume()
+static void alertHandler() {
+  readyStart = conversionStart;
+  readyEnd = conversionEnd;
+  conversionStart = conversionEnd;
+  conversionEnd += conversionMicros();
+  if (suspended) {
+    pending = true;
+  }
+  else {
+    readConversion(readyStart, readyEnd);
+  }
+  simSchedule(alertHandler, conversionEnd);
+}
+
+void samplerStart(const byte *, byte, unsigned long periodMicros) {
+  running = true;
+  continuous = false;
+  suspended = false;
+  pending = false;
+  primed = false;
+  period = periodMicros;
+  sampleBuffer.clear();
+  lateTicks = 0;
+  nextEventAt = simNow() + period;
+  simSchedule(timerHandler, nextEventAt);
+}
+
+void samplerStartContinuous(const byte *, byte, byte) {
+  running = true;
+  continuous = true;
+  suspended = false;
+  pending = false;
+  sampleBuffer.clear();
+  lateTicks = 0;
+  conversionStart = simNow();
+  conversionEnd = conversionStart + conversionMicros();
+  simSchedule(alertHandler, conversionEnd);
+}
+
+void samplerStop() {
+  running = false;
+  simCancel(timerHandler);
+  simCancel(alertHandler);
+}
+
+void samplerSuspend() {
+  if (running) {
+    suspended = true;
+  }
+}
+
+void samplerResume() {
+  if (running) {
+    suspended = false;
+    if (pending) {
+      pending = false;
+      if (continuous) {
+        readConversion(readyStart, readyEnd);
+      }
+      else {
+        timerTick();
+      }
+    }
+  }
+}
+
+unsigned int samplerOverflows() { return sampleBuffer.overflows; }
+unsigned int samplerLateTicks() { return lateTicks; }
+
+void samplerResetCounters() {
+  sampleBuffer.overflows = 0;
+  lateTicks = 0;
+}
+
+// ---- SD card
+
+static void sdPath(const char *name, char *path, size_t len) {
+  snprintf(path, len, "%s/%s", simConfig.sdDir, name);
+}
+
+// a contiguous logfile has data in the SD library's block cache or its multi-block write has
+// started, see contiguouslog.h; any other access to the card would corrupt it on the hardware,
+// so the simulation stops
+static bool contiguousStreaming;
+
+static void checkCardFree(const char *name) {
+  if (contiguousStreaming) {
+    fprintf(stderr, "SD library access to %s while a contiguous logfile is streaming\n", name);
+    exit(4);
+  }
+}
+
+bool storageBegin(int) {
+  mkdir(simConfig.sdDir, 0755);
+  struct stat st;
+  return stat(simConfig.sdDir, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool storageExists(const char *name) {
+  checkCardFree(name);
+  char path[256];
+  sdPath(name, path, sizeof(path));
+  return access(path, F_OK) == 0;
+}
+
+bool storageRemove(const char *name) {
+  checkCardFree(name);
+  char path[256];
+  sdPath(name, path, sizeof(path));
+  simAdvance(simConfig.sdOpenUs);
+  return unlink(path) == 0;
+}
+
+File storageOpen(const char *name, uint8_t mode) {
+  checkCardFree(name);
+  char path[256];
+  sdPath(name, path, sizeof(path));
+  simAdvance(simConfig.sdOpenUs);
+  bool writing = mode == FILE_WRITE;
+  return File(fopen(path, writing ? "ab+" : "rb"), writing);
+}
+
+File storageOpenUpdate(const char *name) {
+  checkCardFree(name);
+  char path[256];
+  sdPath(name, path, sizeof(path));
+  simAdvance(simConfig.sdOpenUs);
+  return File(fopen(path, "rb+"), true);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size) {
+  if (!fp || !writing) {
+    return 0;
+  }
+  // the SD library commits a sector whenever its 512 byte buffer is full
+  uint32_t sectors = (written + size) / 512 - written / 512;
+  simAdvance((uint64_t)size * simConfig.sdByteUs + (uint64_t)sectors * simConfig.sdSectorUs);
+  written += size;
+  dirty = (written % 512) != 0;
+  return fwrite(buffer, 1, size, fp);
+}
+
+int File::available() {
+  if (!fp) {
+    return 0;
+  }
+  long pos = ftell(fp);
+  fseek(fp, 0, SEEK_END);
+  long end = ftell(fp);
+  fseek(fp, pos, SEEK_SET);
+  return end - pos;
+}
+
+int File::read() {
+  return fp ? fgetc(fp) : -1;
+}
+
+uint32_t File::size() {
+  struct stat st;
+  return fp && fstat(fileno(fp), &st) == 0 ? st.st_size : 0;
+}
+
+void File::flush() {
+  if (fp && dirty) {
+    simAdvance(simConfig.sdFlushUs);
+    dirty = false;
+  }
+  if (fp) {
+    fflush(fp);
+  }
+}
+
+void File::close() {
+  if (fp) {
+    flush();
+    fclose(fp);
+    fp = NULL;
+  }
+}
+
+// pre-allocated logfiles: no FAT updates, every full sector costs one raw block write
+class SimContiguousLog : public Print {
+public:
+  bool open(const char *path, uint32_t size) {
+    fp = fopen(path, "wbx");
+    capacity = size;
+    written = 0;
+    full = false;
+    return fp != NULL;
+  }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if (full || written + size > capacity) {
+      full = true;
+      return 0;
+    }
+    uint32_t sectors = (written + size) / 512 - written / 512;
+    simAdvance((uint64_t)sectors * simConfig.sdRawSectorUs);
+    contiguousStreaming = contiguousStreaming || size > 0;
+    written += size;
+    return fwrite(buffer, 1, size, fp);
+  }
+  void close() {
+    if (written % 512) {
+      simAdvance(simConfig.sdRawSectorUs);
+    }
+    // truncating to the written length updates FAT and directory
+    simAdvance(simConfig.sdOpenUs);
+    fclose(fp);
+    fp = NULL;
+    contiguousStreaming = false;
+  }
+  bool full;
+
+private:
+  FILE *fp = NULL;
+  uint32_t capacity;
+  uint32_t written;
+};
+
+static SimContiguousLog contiguousLog;
+
+bool storageBeginContiguous(int) {
+  return true;
+}
+
+Print *storageOpenContiguous(const char *name, uint32_t size) {
+  checkCardFree(name);
+  char path[256];
+  sdPath(name, path, sizeof(path));
+  // allocating the clusters
+  simAdvance(simConfig.sdOpenUs);
+  return contiguousLog.open(path, size) ? &contiguousLog : NULL;
+}
+
+bool storageContiguousFull() {
+  return contiguousLog.full;
+}
+
+bool storageContiguousStreaming() {
+  return contiguousStreaming;
+}
+
+void storageCloseContiguous() {
+  contiguousLog.close();
+}
+
+// ---- DS1307, starts at 2026-01-01 00:00:00 and runs on the virtual clock, simConfig.rtcPpm fast
+
+// RTC second n starts at this virtual time
+static uint64_t rtcSecondStart(uint64_t n) {
+  return n * 1000000000000ULL / (1000000 + simConfig.rtcPpm);
+}
+
+static void (*squareWaveHandler)();
+static uint64_t squareWaveSecond;
+
+static void squareWaveEdge() {
+  // in STANDBY the falling edge does not wake the MCU
+  if (!simTimerStopped()) {
+    squareWaveHandler();
+  }
+  squareWaveSecond++;
+  simSchedule(squareWaveEdge, rtcSecondStart(squareWaveSecond));
+}
+
+void rtcsetup(char const *, char const *) {
+  Serial.println(F("simulated RTC"));
+}
+
+void rtcStartSquareWave(byte, void (*onEdge)()) {
+  // setting the SQW/OUT mode, 2 bytes at 100kHz
+  simAdvance(300);
+  if (!simConfig.rtcSquareWave) {
+    return;
+  }
+  squareWaveHandler = onEdge;
+  squareWaveSecond = simNow() * (1000000 + simConfig.rtcPpm) / 1000000000000ULL + 1;
+  simSchedule(squareWaveEdge, rtcSecondStart(squareWaveSecond));
+}
+
+bool rtcGetDateTime(DateTime &now, bool) {
+  // reading 7 bytes at 100kHz
+  simAdvance(900);
+  time_t t = 1767225600 + (time_t)(simNow() * (1000000 + simConfig.rtcPpm) / 1000000000000ULL);
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  now.year = tm.tm_year + 1900;
+  now.month = tm.tm_mon + 1;
+  now.day = tm.tm_mday;
+  now.hour = tm.tm_hour;
+  now.minute = tm.tm_min;
+  now.second = tm.tm_sec;
+  return true;
+}
+
+void reboot() {
+  Serial.println(F("reboot"));
+  exit(3);
+}
+
+// the native build has no SRAM of the MCU to measure, it reports the size of the ATmega4809's
+void ramPaint() {}
+
+void ramUsage(RamUsage &r) {
+  memset(&r, 0, sizeof(r));
+  r.total = 6144;
+}
@@ -0,0 +1,126 @@
+#include "aggregate.h"
+#include "csvrow.h"
+
+enum {
+  QUANTITY_VOLTAGE,  // load voltage, LSB 1.25mV
+  QUANTITY_CURRENT,  // current, negated as in processSample(), LSB currentLSB_mA
+  QUANTITY_POWER,    // power, LSB 25 * currentLSB_mA
+  QUANTITY_COUNT
+};
+
+struct Quantity {
+  long minRaw;
+  long maxRaw;
+  // 64 bit, a window of an hour at a few kHz overflows 32 bit sums
+  int64_t sum;
+  uint64_t sumSquares;
+};
+
+static Quantity quantities[MAX_CHANNELS][QUANTITY_COUNT];
+static byte channelCount = 1;
+static unsigned long count;
+static bool overflow;
+static unsigned long windowMicros;
+static unsigned long firstMillis;
+static unsigned long firstMicros;
+
+void aggregateBegin(unsigned long startMicros, byte channels) {
+  memset(quantities, 0, sizeof(quantities));
+  channelCount = channels;
+  count = 0;
+  overflow = false;
+  windowMicros = startMicros;
+}
+
+void aggregateAdd(const Sample &s) {
+  if (count == 0) {
+    firstMillis = s.millis;
+    firstMicros = s.micros;
+  }
+  for (byte ch = 0; ch < channelCount; ch++) {
+    // the load voltage is the bus voltage minus the shunt voltage; the shunt voltage LSB is 1/500 of
+    // the bus voltage LSB, so it is rounded to the bus voltage LSB to keep the squares in 32 bit
+    long shunt = s.ch[ch].shuntRaw;
+    long values[QUANTITY_COUNT] = {
+      (long)s.ch[ch].busRaw - (shunt >= 0 ? shunt + 250 : shunt - 250) / 500,
+      -(long)s.ch[ch].currentRaw,
+      (long)s.ch[ch].powerRaw
+    };
+    for (uint8_t i = 0; i < QUANTITY_COUNT; i++) {
+      Quantity &q = quantities[ch][i];
+      long v = values[i];
+      if (count == 0 || v < q.minRaw) {
+        q.minRaw = v;
+      }
+      if (count == 0 || v > q.maxRaw) {
+        q.maxRaw = v;
+      }
+      q.sum += v;
+      uint32_t magnitude = v < 0 ? -v : v;
+      q.sumSquares += magnitude * magnitude;
+    }
+  }
+  if (s.flags) {
+    overflow = true;
+  }
+  count++;
+}
+
+unsigned long aggregateCount() {
+  return count;
+}
+
+bool aggregateDue(unsigned long micros, unsigned long interval) {
+  return micros - windowMicros >= interval;
+}
+
+void aggregateNext(unsigned long micros, unsigned long interval) {
+  unsigned long next = windowMicros + interval;
+  aggregateBegin(micros - next < interval ? next : micros, channelCount);
+}
+
+void aggregateWriteHeader(Print &out) {
+  if (channelCount == 1) {
+    out.println(F("millis,micros,samples,status,"
+                  "V_min,V_mean,V_max,V_rms,mA_min,mA_mean,mA_max,mA_rms,mW_min,mW_mean,mW_max,mW_rms,time_s"));
+    return;
+  }
+  out.print(F("millis,micros,samples,status"));
+  for (byte ch = 1; ch <= channelCount; ch++) {
+    out.print(F(",V_min_"));   out.print(ch);
+    out.print(F(",V_mean_"));  out.print(ch);
+    out.print(F(",V_max_"));   out.print(ch);
+    out.print(F(",V_rms_"));   out.print(ch);
+    out.print(F(",mA_min_"));  out.print(ch);
+    out.print(F(",mA_mean_")); out.print(ch);
+    out.print(F(",mA_max_"));  out.print(ch);
+    out.print(F(",mA_rms_"));  out.print(ch);
+    out.print(F(",mW_min_"));  out.print(ch);
+    out.print(F(",mW_mean_")); out.print(ch);
+    out.print(F(",mW_max_"));  out.print(ch);
+    out.print(F(",mW_rms_"));  out.print(ch);
+  }
+  out.println(F(",time_s"));
+}
+
+void aggregateWrite(Print &out, float currentLSB_mA) {
+  const float lsb[QUANTITY_COUNT] = {0.00125f, currentLSB_mA, 25.0f * currentLSB_mA};
+  // millis and micros of the first sample of the window
+  out.print(firstMillis); out.print(",");
+  out.print(firstMicros); out.print(",");
+  out.print(count);       out.print(",");
+  out.print(overflow ? F("overflow") : F("ok"));
+  float n = count ? count : 1;
+  for (byte ch = 0; ch < channelCount; ch++) {
+    for (uint8_t i = 0; i < QUANTITY_COUNT; i++) {
+      const Quantity &q = quantities[ch][i];
+      out.print(","); out.print(q.minRaw * lsb[i], 5);
+      out.print(","); out.print(q.sum / n * lsb[i], 5);
+      out.print(","); out.print(q.maxRaw * lsb[i], 5);
+      out.print(","); out.print(sqrt(q.sumSquares / n) * lsb[i], 5);
+    }
+  }
+  out.print(",");
+  csvPrintTime(out, firstMicros);
+  out.println();
+}
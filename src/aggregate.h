@@ -0,0 +1,22 @@
+#pragma once
+// Aggregation of the samples of one logging interval (LOGGER.INI line 10)
+//
+// With aggregation the INA226 is read as fast as possible and the logfile gets one row per
+// logging interval with the number of samples and min, mean, max and RMS of the load voltage,
+// the current and the power of every INA226 channel. The accumulators work on the raw register
+// values, which keeps the per sample cost at a few integer additions and multiplications.
+
+#include "hal.h"
+
+// starts a window with the given sample time and number of channels, without samples
+void aggregateBegin(unsigned long startMicros, byte channels);
+void aggregateAdd(const Sample &s);
+unsigned long aggregateCount();
+// true if the window started interval microseconds or more before micros
+bool aggregateDue(unsigned long micros, unsigned long interval);
+// starts the next window of the interval grid; if micros is already past it, the grid restarts at micros
+void aggregateNext(unsigned long micros, unsigned long interval);
+// the columns of every channel get the suffix _1, _2, ... if there is more than one
+void aggregateWriteHeader(Print &out);
+// writes the row of the current window; currentLSB_mA is the LSB of the current register
+void aggregateWrite(Print &out, float currentLSB_mA);
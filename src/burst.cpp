@@ -0,0 +1,56 @@
+#include "burst.h"
+
+static uint16_t currentStepRaw;
+static uint16_t busStepRaw;
+static unsigned long holdMicros;
+static byte channelCount = 1;
+
+static ChannelSample prev[MAX_CHANNELS];
+static bool havePrev;
+static bool active;
+// micros() of the last step
+static unsigned long stepMicros;
+
+void burstBegin(uint16_t currentStep, uint16_t busStep, unsigned long hold, byte channels) {
+  currentStepRaw = currentStep;
+  busStepRaw = busStep;
+  holdMicros = hold;
+  channelCount = channels;
+  burstEnd();
+}
+
+// true if the two values differ by at least step, with step 0 never
+static bool isStep(int32_t a, int32_t b, uint16_t step) {
+  int32_t d = a - b;
+  return step > 0 && (d < 0 ? -d : d) >= step;
+}
+
+void burstCheck(const Sample &s) {
+  bool step = false;
+  for (byte ch = 0; ch < channelCount; ch++) {
+    const ChannelSample &c = s.ch[ch];
+    if (havePrev && (isStep(c.currentRaw, prev[ch].currentRaw, currentStepRaw)
+                     || isStep(c.busRaw, prev[ch].busRaw, busStepRaw))) {
+      step = true;
+    }
+    prev[ch] = c;
+  }
+  havePrev = true;
+
+  if (step) {
+    active = true;
+    stepMicros = s.micros;
+  }
+  else if (active && s.micros - stepMicros >= holdMicros) {
+    active = false;
+  }
+}
+
+bool burstActive() {
+  return active;
+}
+
+void burstEnd() {
+  active = false;
+  havePrev = false;
+}
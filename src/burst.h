@@ -0,0 +1,27 @@
+#pragma once
+// Adaptive sampling rate (LOGGER.INI lines 19 to 22)
+//
+// A fixed frequency either fills the card with flat data or misses the load steps. With a burst
+// frequency the logger measures at the configured frequency, with its long averaging and
+// conversion times, and compares every sample with the previous one. A step of the current or
+// the bus voltage of at least the configured size on any channel starts a burst: the logger
+// switches to the short conversion times of the burst frequency and measures at that rate until
+// no step was seen for the hold time, then it drops back. Steps during a burst extend it.
+// The steps are the same between two samples at either rate, so the conversion noise of the
+// short conversion times does not keep a burst going on its own.
+//
+// The detection works on the raw register values; main.cpp applies the rates and marks every
+// change in the logfile (LOG_STATUS_RATE / LOG_TAG_RATE in logformat.h).
+
+#include "hal.h"
+
+// steps in the LSB of the current and bus voltage registers, 0 = not checked; the hold time in
+// microseconds. Ends a burst.
+void burstBegin(uint16_t currentStep, uint16_t busStep, unsigned long holdMicros, byte channels);
+// compares the sample with the previous one; a step starts a burst or extends it, a sample
+// after the hold time ends it
+void burstCheck(const Sample &s);
+// true while the samples are to be taken at the burst frequency
+bool burstActive();
+// ends a burst, e.g. when the logfile is closed; the next sample is compared with nothing
+void burstEnd();
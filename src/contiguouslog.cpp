@@ -0,0 +1,116 @@
+#include "contiguouslog.h"
+#include "hal.h"
+
+ContiguousLog contiguousLog;
+
+static const uint16_t SECTOR_SIZE = 512;
+
+bool ContiguousLog::begin(uint8_t chipSelect) {
+  if (root.isOpen()) {
+    return true;
+  }
+  // same SPI speed as SD.begin()
+  return card.init(SPI_HALF_SPEED, chipSelect) && volume.init(&card) && root.openRoot(&volume);
+}
+
+bool ContiguousLog::open(const char *name, uint32_t size) {
+  uint32_t bgnBlock;
+  if (!file.createContiguous(&root, name, size)) {
+    return false;
+  }
+  if (!file.contiguousRange(&bgnBlock, &endBlock)) {
+    file.close();
+    return false;
+  }
+  nextBlock = bgnBlock;
+  sector = NULL;
+  fill = 0;
+  written = 0;
+  streaming = false;
+  full = false;
+  return true;
+}
+
+bool ContiguousLog::writeSector() {
+  if (nextBlock > endBlock) {
+    full = true;
+    return false;
+  }
+  // the multi-block write starts with the first sector; close() ends it
+  if (!streaming) {
+    if (!card.writeStart(nextBlock, endBlock - nextBlock + 1)) {
+      full = true;
+      return false;
+    }
+    streaming = true;
+  }
+  if (!card.writeData(sector)) {
+    full = true;
+    return false;
+  }
+  nextBlock++;
+  fill = 0;
+  return true;
+}
+
+size_t ContiguousLog::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t ContiguousLog::write(const uint8_t *buffer, size_t size) {
+  if (full) {
+    return 0;
+  }
+  if (!sector) {
+    // writes back what the SD library left in the cache, and invalidates it
+    sector = SdVolume::cacheClear();
+  }
+  size_t done = 0;
+  while (done < size) {
+    size_t n = min(size - done, (size_t)(SECTOR_SIZE - fill));
+    memcpy(sector + fill, buffer + done, n);
+    fill += n;
+    done += n;
+    if (fill == SECTOR_SIZE && !writeSector()) {
+      break;
+    }
+  }
+  written += done;
+  return done;
+}
+
+void ContiguousLog::close() {
+  if (fill > 0 && !full) {
+    memset(sector + fill, 0, SECTOR_SIZE - fill);
+    writeSector();
+  }
+  if (streaming) {
+    card.writeStop();
+  }
+  // the block cache belongs to the SD library again; it releases the clusters after the data
+  // and updates the directory entry
+  sector = NULL;
+  file.truncate(written);
+  file.close();
+  streaming = false;
+}
+
+bool storageBeginContiguous(int chipSelect) {
+  return contiguousLog.begin(chipSelect);
+}
+
+Print *storageOpenContiguous(const char *name, uint32_t size) {
+  return contiguousLog.open(name, size) ? &contiguousLog : NULL;
+}
+
+bool storageContiguousFull() {
+  return contiguousLog.isFull();
+}
+
+bool storageContiguousStreaming() {
+  return contiguousLog.isStreaming();
+}
+
+void storageCloseContiguous() {
+  contiguousLog.close();
+}
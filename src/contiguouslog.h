@@ -0,0 +1,59 @@
+#pragma once
+// Pre-allocated, contiguous logfiles written with raw multi-block SD card writes
+//
+// When a logfile grows through the SD library, every new cluster means FAT and directory
+// updates; these are the 14ms stalls we see while logging. ContiguousLog allocates the
+// whole file when the measurement cycle starts, collects the log data in a 512 byte
+// sector buffer and streams full sectors straight to the card, without any file system
+// work. close() truncates the file to the data actually written. The sector buffer is the
+// block cache of the SD library, which has nothing to cache while the file is written.
+//
+// While a file is open, other files on the card must only be accessed before the first
+// byte is written (the INI file is written right after opening the logfile, before its
+// header, see stageLogfile() and processSample() in main.cpp): the data waits in the block
+// cache, and the multi-block write occupies the card until close().
+// After a power loss the file keeps its pre-allocated size; the data after the last
+// complete sector is whatever the card contained before.
+
+#include <Arduino.h>
+#include <SD.h>
+
+class ContiguousLog : public Print {
+public:
+  // call after SD.begin(); uses its own card and volume objects, the SD library's
+  // block cache is shared between all volumes
+  bool begin(uint8_t chipSelect);
+
+  // creates the file with the given size in bytes; fails if the file exists or the
+  // card has no contiguous free space of that size
+  bool open(const char *name, uint32_t size);
+  void close();
+
+  // true once the pre-allocated size is used up; further data is dropped
+  bool isFull() const { return full; }
+  // true from the first byte written to close()
+  bool isStreaming() const { return sector != NULL; }
+  uint32_t length() const { return written; }
+
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+private:
+  bool writeSector();
+
+  Sd2Card card;
+  SdVolume volume;
+  SdFile root;
+  SdFile file;
+  // the SD library's block cache while data is written, otherwise NULL
+  uint8_t *sector;
+  uint16_t fill;
+  uint32_t nextBlock;
+  uint32_t endBlock;
+  uint32_t written;
+  bool streaming;
+  bool full;
+};
+
+extern ContiguousLog contiguousLog;
@@ -0,0 +1,129 @@
+#include <string.h>
+#include "csvformat.h"
+
+// a positive 32 bit float, mantissa x 2^exponent with a mantissa of 24 significant bits, or 0
+struct Float32 {
+  uint32_t mantissa;
+  int16_t exponent;
+};
+
+static Float32 voltageLSB;
+static Float32 currentLSB;
+
+// a positive normal float
+static Float32 fromFloat(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  Float32 r;
+  r.mantissa = (bits & 0x7FFFFF) | 0x800000;
+  r.exponent = (int16_t)((bits >> 23) & 0xFF) - 150;
+  return r;
+}
+
+// v x 2^exponent rounded to 24 significant bits, to nearest with ties to even, as the
+// conversion of an integer to float and the float multiplication round
+static Float32 toFloat(uint64_t v, int16_t exponent) {
+  uint8_t shift = 0;
+  while ((v >> shift) >= (1UL << 24)) {
+    shift++;
+  }
+  if (shift) {
+    uint64_t rest = v & ((1ULL << shift) - 1);
+    uint64_t half = 1ULL << (shift - 1);
+    v >>= shift;
+    if (rest > half || (rest == half && (v & 1))) {
+      v++;
+      // a carry out of the mantissa; the lost bit is 0
+      if (v >> 24) {
+        v >>= 1;
+        shift++;
+      }
+    }
+  }
+  Float32 r;
+  r.mantissa = v;
+  r.exponent = exponent + shift;
+  return r;
+}
+
+static Float32 multiply(const Float32 &a, const Float32 &b) {
+  return toFloat((uint64_t)a.mantissa * b.mantissa, a.exponent + b.exponent);
+}
+
+void csvBegin(float currentLSB_mA) {
+  // the literal 0.0000025 of scaleSample() is a float on the AVR
+  voltageLSB = fromFloat(2.5e-6f);
+  currentLSB = fromFloat(currentLSB_mA);
+}
+
+char *csvAppendUnsigned(char *p, uint32_t v) {
+  char digits[10];
+  uint8_t n = 0;
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+// appends whole.fraction with 5 decimals; fraction is in units of 0.00001 and may be 100000
+// after rounding. The sign is written even if the value rounds to 0, like String() does.
+static char *appendDecimal(char *p, bool negative, uint32_t whole, uint32_t fraction) {
+  if (fraction >= 100000) {
+    whole++;
+    fraction -= 100000;
+  }
+  if (negative) {
+    *p++ = '-';
+  }
+  p = csvAppendUnsigned(p, whole);
+  *p++ = '.';
+  for (uint8_t i = 5; i-- > 0; ) {
+    p[i] = '0' + fraction % 10;
+    fraction /= 10;
+  }
+  return p + 5;
+}
+
+// appends ",value" with 5 decimals, the exact value of the float rounded to nearest with ties to even
+static char *appendValue(char *p, bool negative, const Float32 &f) {
+  uint32_t whole = 0;
+  uint32_t fraction = 0;
+  if (f.exponent >= 0) {
+    whole = f.mantissa << f.exponent;
+  }
+  else if (f.exponent >= -46) {
+    // the bits below the point times 100000 fit into 64 bits; anything smaller than
+    // 2^24 x 2^-47 rounds to 0
+    uint8_t bits = -f.exponent;
+    uint64_t mask = (1ULL << bits) - 1;
+    if (bits < 32) {
+      whole = f.mantissa >> bits;
+    }
+    uint64_t scaled = (f.mantissa & mask) * 100000ULL;
+    fraction = scaled >> bits;
+    uint64_t rest = scaled & mask;
+    uint64_t half = 1ULL << (bits - 1);
+    if (rest > half || (rest == half && (fraction & 1))) {
+      fraction++;
+    }
+  }
+  *p++ = ',';
+  return appendDecimal(p, negative, whole, fraction);
+}
+
+char *csvAppendValues(char *p, uint16_t busRaw, int16_t shuntRaw, int16_t currentRaw, uint16_t powerRaw) {
+  // load voltage: loadVoltageRaw() of hal.h, in the shunt voltage LSB of 2.5uV
+  int32_t voltage = (int32_t)busRaw * 500 - shuntRaw;
+  p = appendValue(p, voltage < 0, multiply(toFloat(voltage < 0 ? -voltage : voltage, 0), voltageLSB));
+
+  // current: negated as in scaleSample()
+  int32_t current = -(int32_t)currentRaw;
+  p = appendValue(p, current < 0, multiply(toFloat(current < 0 ? -current : current, 0), currentLSB));
+
+  // power: powerRaw x 25 is exact in a float
+  return appendValue(p, false, multiply(toFloat((uint32_t)powerRaw * 25, 0), currentLSB));
+}
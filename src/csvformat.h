@@ -0,0 +1,28 @@
+#pragma once
+// The measured values of an INA226 channel as CSV columns, formatted from the raw register values
+//
+// Every value is the 32 bit float the logger always calculated, the load voltage in V as
+// loadVoltageRaw x 2.5e-6, the current in mA as -currentRaw x currentLSB_mA and the power in mW
+// as powerRaw x 25 x currentLSB_mA, written with 5 decimals as String(value, 5) does, i.e. the
+// float rounded to nearest with ties to even. The float multiplications and the conversion to
+// decimal are emulated in integer arithmetic; no floats and no heap on the logging path.
+//
+// This file uses fixed width types only, so the host tools (tools/logdecode.cpp and
+// tools/streamrecv.cpp) compile csvformat.cpp and write exactly the text the logger writes.
+// The rows of logfiles in log format 0 are put together in csvrow.h.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the text of csvAppendValues(): per value a comma, sign, 7 digits, point and 5 decimals
+#define CSV_VALUES_CHARS (3 * (1 + 1 + 7 + 1 + 5))
+// the power has at most 7 digits up to this current LSB, i.e. a current range of 196A
+#define CSV_MAX_CURRENT_LSB_MA 6.0f
+
+// currentLSB_mA is the LSB of the current register in mA, see setResistorRange() in INA226_WE,
+// a normal float of at most CSV_MAX_CURRENT_LSB_MA; call before the first csvAppendValues()
+void csvBegin(float currentLSB_mA);
+// appends ",V,mA,mW" of one channel and returns the end of the text, which is not terminated
+char *csvAppendValues(char *p, uint16_t busRaw, int16_t shuntRaw, int16_t currentRaw, uint16_t powerRaw);
+// appends the decimal digits of v
+char *csvAppendUnsigned(char *p, uint32_t v);
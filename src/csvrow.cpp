@@ -0,0 +1,57 @@
+#include "csvrow.h"
+
+// millis, micros, "overflow", the values of every channel, time_s, the separators and CR LF
+static const size_t CSV_TIME_CHARS = 10 + 1 + 6;
+static char line[10 + 1 + 10 + 1 + 8 + MAX_CHANNELS * CSV_VALUES_CHARS + 1 + CSV_TIME_CHARS + 2];
+static byte channelCount = 1;
+static TimeStamp origin;
+
+void csvRowBegin(float currentLSB_mA, byte channels) {
+  csvBegin(currentLSB_mA);
+  channelCount = channels;
+}
+
+// appends the seconds since origin of a micros() value, with 6 decimals
+static char *appendTime(char *p, unsigned long micros) {
+  TimeStamp t;
+  timebaseAt(micros, t);
+  uint32_t seconds, fraction;
+  timebaseSince(origin, t, seconds, fraction);
+  p = csvAppendUnsigned(p, seconds);
+  *p++ = '.';
+  for (byte i = 6; i-- > 0; ) {
+    p[i] = '0' + fraction % 10;
+    fraction /= 10;
+  }
+  return p + 6;
+}
+
+void csvWriteRow(Print &out, const Sample &s) {
+  char *p = line;
+  p = csvAppendUnsigned(p, s.millis);
+  *p++ = ',';
+  p = csvAppendUnsigned(p, s.micros);
+  *p++ = ',';
+  const char *status = s.flags ? "overflow" : "ok";
+  while (*status) {
+    *p++ = *status++;
+  }
+  for (byte ch = 0; ch < channelCount; ch++) {
+    const ChannelSample &c = s.ch[ch];
+    p = csvAppendValues(p, c.busRaw, c.shuntRaw, c.currentRaw, c.powerRaw);
+  }
+  *p++ = ',';
+  p = appendTime(p, s.micros);
+  *p++ = '\r';
+  *p++ = '\n';
+  out.write((const uint8_t *)line, p - line);
+}
+
+void csvSetOrigin(const TimeStamp &t) {
+  origin = t;
+}
+
+size_t csvPrintTime(Print &out, unsigned long micros) {
+  char text[CSV_TIME_CHARS];
+  return out.write((const uint8_t *)text, appendTime(text, micros) - text);
+}
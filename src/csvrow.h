@@ -0,0 +1,19 @@
+#pragma once
+// CSV rows of logfiles in log format 0
+//
+// The columns are millis, micros, status, the values of every channel as csvformat.h formats
+// them, and last time_s (the seconds since the start time of the logfile on the time base, see
+// timebase.h, with 6 decimals). A row is put together in a static line buffer and written with
+// one write() call.
+
+#include "csvformat.h"
+#include "hal.h"
+#include "timebase.h"
+
+// currentLSB_mA as for csvBegin()
+void csvRowBegin(float currentLSB_mA, byte channels);
+void csvWriteRow(Print &out, const Sample &s);
+// time_s counts from origin, the start time of the logfile
+void csvSetOrigin(const TimeStamp &origin);
+// the time_s column of a row, for rows not written by csvWriteRow()
+size_t csvPrintTime(Print &out, unsigned long micros);
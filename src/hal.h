@@ -0,0 +1,162 @@
+#pragma once
+// Hardware abstraction layer
+//
+// main.cpp talks to the INA226, the SD card and the RTC only through the functions declared
+// here; the clock (millis(), micros(), delay()) and Serial are used through the Arduino core API.
+// On the Nano Every these are implemented by hal_avr.cpp, sampler.cpp, contiguouslog.cpp and
+// rtc.cpp. The native build (env:native in platformio.ini) replaces them with the simulated
+// peripherals and the virtual clock in sim/, so the same setup() and loop() run on Linux.
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <SD.h>
+#include <INA226_WE.h>
+#else
+#include "simcore.h"
+
+// same values as in INA226_WE.h
+typedef enum {
+  AVERAGE_1 = 0x0000, AVERAGE_4 = 0x0200, AVERAGE_16 = 0x0400, AVERAGE_64 = 0x0600,
+  AVERAGE_128 = 0x0800, AVERAGE_256 = 0x0A00, AVERAGE_512 = 0x0C00, AVERAGE_1024 = 0x0E00
+} averageMode;
+typedef enum {
+  CONV_TIME_140 = 0, CONV_TIME_204 = 1, CONV_TIME_332 = 2, CONV_TIME_588 = 3,
+  CONV_TIME_1100 = 4, CONV_TIME_2116 = 5, CONV_TIME_4156 = 6, CONV_TIME_8244 = 7
+} convTime;
+#endif
+
+// number of INA226 devices (channels) the firmware supports, e.g. source, load and charger;
+// every channel takes 8 bytes in each Sample of the sample buffer
+#define MAX_CHANNELS 3
+
+// Sample.flags: bit i is set if channel i reported an overflow
+#define SAMPLE_OVERFLOW 0x01
+
+// raw register values of one INA226
+struct ChannelSample {
+  uint16_t busRaw;
+  int16_t shuntRaw;
+  int16_t currentRaw;
+  uint16_t powerRaw;
+};
+
+// The INA226 calculates its current and power registers from the voltage registers:
+// current = shunt x CAL / 2048 and power = |current| x bus / 20000. The acquisition reads only
+// the shunt and bus voltage registers and derives the other two the same way, in integer
+// arithmetic; false if a result does not fit into its register, which the INA226 reports as
+// a math overflow.
+static inline bool deriveCurrentPower(ChannelSample &c, uint16_t calibration) {
+  int32_t current = (int32_t)c.shuntRaw * calibration / 2048;
+  bool ok = current >= -32768 && current <= 32767;
+  if (!ok) {
+    current = current < 0 ? -32768 : 32767;
+  }
+  c.currentRaw = current;
+  uint32_t power = (uint32_t)(current < 0 ? -current : current) * c.busRaw / 20000;
+  if (power > 65535) {
+    power = 65535;
+    ok = false;
+  }
+  c.powerRaw = power;
+  return ok;
+}
+
+// load voltage, i.e. the bus voltage minus the shunt voltage, with the 2.5uV LSB of the
+// shunt voltage register (the bus voltage LSB is 500 times that)
+static inline int32_t loadVoltageRaw(const ChannelSample &c) {
+  return (int32_t)c.busRaw * 500 - c.shuntRaw;
+}
+
+// one measurement of all INA226 devices
+struct Sample {
+  unsigned long millis;
+  unsigned long micros;
+  ChannelSample ch[MAX_CHANNELS];
+  uint8_t flags;
+};
+
+// I2C clock for the INA226 devices; the DS1307 supports 100kHz only, so the clock is lowered
+// while the RTC is read
+#define I2C_FAST_CLOCK 400000
+#define I2C_RTC_CLOCK 100000
+
+// INA226 devices at the given I2C addresses, all with the same shunt and settings
+// sets up the I2C bus at I2C_FAST_CLOCK and the calibration, see setResistorRange() and
+// setCorrectionFactor() in INA226_WE
+void sensorBegin(const byte *i2cAddresses, byte channels, float shuntResistor, float currentRange,
+                 float correctionFactor);
+void sensorConfigure(averageMode avg, convTime ctShunt, convTime ctBus);
+void sensorStartTriggered();
+// CONTINUOUS mode with a latched conversion ready alert on the ALERT pin of the first device
+void sensorStartContinuous();
+// triggers a conversion on all devices, waits until they are finished and reads the results;
+// the conversions run in parallel, so this takes one conversion time plus the I2C traffic of
+// one register write and, per device, three register reads (Mask/Enable, shunt and bus voltage)
+void sensorAcquire(Sample &s);
+
+// alert functions of the INA226 Mask/Enable register: ALERT trips when a conversion is above
+// (over) or below (under) the alert limit, a value in the unit of the compared register
+#define ALERT_SHUNT_OVER 0x8000
+#define ALERT_SHUNT_UNDER 0x4000
+#define ALERT_BUS_OVER 0x2000
+#define ALERT_POWER_OVER 0x0800
+// low-power standby: the first device converts continuously, only what the alert function
+// compares, with the configured AVG and CT, and latches ALERT when a conversion trips the limit;
+// the other devices are powered down. The MCU sleeps in STANDBY until then, i.e. millis() and
+// micros() stand still and the RTC square wave is not counted. Afterwards the devices must be
+// started again with sensorStartTriggered() or sensorStartContinuous().
+void sensorSleepUntilAlert(uint16_t function, uint16_t limit, byte alertPin);
+
+// SD card; files are opened with FILE_READ or FILE_WRITE
+bool storageBegin(int chipSelect);
+bool storageExists(const char *name);
+bool storageRemove(const char *name);
+File storageOpen(const char *name, uint8_t mode);
+// opens an existing file for writing from its start, without truncating it; FILE_WRITE appends
+File storageOpenUpdate(const char *name);
+
+// pre-allocated, contiguous logfiles, see contiguouslog.h; storageOpenContiguous() returns
+// NULL if the file can not be allocated. While storageContiguousStreaming(), i.e. from the first
+// byte written to the file to its close, the card and the block cache of the SD library belong to
+// the file: the functions above fail without touching them.
+bool storageBeginContiguous(int chipSelect);
+Print *storageOpenContiguous(const char *name, uint32_t size);
+bool storageContiguousFull();
+bool storageContiguousStreaming();
+void storageCloseContiguous();
+
+// DS1307
+struct DateTime {
+  uint16_t year;
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+};
+void rtcsetup(char const *compile_date, char const *compile_time);
+// reads the current date and time; false if the RTC could not be read, with messages and an
+// error message on Serial
+bool rtcGetDateTime(DateTime &now, bool messages = true);
+// switches the SQW/OUT pin of the DS1307 to the 1Hz square wave and calls onEdge from the interrupt
+// of its falling edge, at which the seconds of the DS1307 advance; see timebase.h
+void rtcStartSquareWave(byte pin, void (*onEdge)());
+
+// restarts the firmware
+void reboot();
+
+// SRAM: the static data (.data and .bss) at the bottom, the heap above it, the stack growing down
+// from the top. The firmware allocates nothing after setup(), the heap holds the file objects of
+// the SD library only. ramPaint() fills the free RAM between heap and stack with a pattern; the
+// part of it the stack overwrote since is its high-water mark.
+struct RamUsage {
+  uint16_t total;
+  uint16_t staticBytes;
+  uint16_t heapBytes;
+  // the deepest stack since ramPaint(), and the free bytes between it and the heap
+  uint16_t stackBytes;
+  uint16_t headroomBytes;
+};
+// call first thing in setup()
+void ramPaint();
+void ramUsage(RamUsage &r);
@@ -0,0 +1,239 @@
+// Nano Every implementation of the sensor, storage and system functions in hal.h
+#include <Arduino.h>
+#include <Wire.h>
+#include <INA226_WE.h>
+#include <SPI.h>
+#include <SD.h>
+#include <avr/sleep.h>
+#include "hal.h"
+
+static INA226_WE devices[MAX_CHANNELS];
+static byte addresses[MAX_CHANNELS];
+static byte channelCount;
+// the calibration register of every device, for deriveCurrentPower()
+static uint16_t calibration[MAX_CHANNELS];
+// the configuration register with the operating mode "shunt and bus, triggered"; writing it
+// starts a conversion
+static uint16_t confTrigger;
+
+// INA226 registers accessed directly
+const byte INA226_CONF_REGISTER = 0x00;
+const byte INA226_SHUNT_REGISTER = 0x01;
+const byte INA226_BUS_REGISTER = 0x02;
+const byte INA226_CALIBRATION_REGISTER = 0x05;
+const byte INA226_MASK_ENABLE_REGISTER = 0x06;
+const byte INA226_ALERT_LIMIT_REGISTER = 0x07;
+const uint16_t INA226_CONVERSION_READY_FLAG = 0x0008;
+const uint16_t INA226_MATH_OVERFLOW_FLAG = 0x0004;
+const uint16_t INA226_ALERT_LATCH = 0x0001;
+const uint16_t INA226_MODE_MASK = 0x0007;
+const uint16_t INA226_MODE_TRIGGERED = 0x0003;
+const uint16_t INA226_MODE_POWER_DOWN = 0x0000;
+const uint16_t INA226_MODE_SHUNT_CONTINUOUS = 0x0005;
+const uint16_t INA226_MODE_BUS_CONTINUOUS = 0x0006;
+const uint16_t INA226_MODE_CONTINUOUS = 0x0007;
+
+// reads a 16 bit INA226 register in one transaction, with a repeated start; used instead of the
+// INA226_WE getters, so we get the raw values and avoid the float conversions
+static uint16_t readINA226Register(byte address, byte reg) {
+  Wire.beginTransmission(address);
+  Wire.write(reg);
+  Wire.endTransmission(false);
+  Wire.requestFrom(address, (uint8_t)2);
+  uint16_t val = Wire.read() << 8;
+  val |= Wire.read();
+  return val;
+}
+
+static void writeINA226Register(byte address, byte reg, uint16_t val) {
+  Wire.beginTransmission(address);
+  Wire.write(reg);
+  Wire.write(val >> 8);
+  Wire.write(val & 0xFF);
+  Wire.endTransmission();
+}
+
+void sensorBegin(const byte *i2cAddresses, byte channels, float shuntResistor, float currentRange,
+                 float correctionFactor) {
+  channelCount = channels;
+  Wire.begin();
+  for (byte i = 0; i < channelCount; i++) {
+    addresses[i] = i2cAddresses[i];
+    devices[i] = INA226_WE(addresses[i]);
+    devices[i].init();
+    devices[i].setResistorRange(shuntResistor, currentRange);
+    devices[i].setCorrectionFactor(correctionFactor);
+    devices[i].readAndClearFlags();
+    devices[i].waitUntilConversionCompleted();
+    calibration[i] = readINA226Register(addresses[i], INA226_CALIBRATION_REGISTER);
+  }
+  Wire.setClock(I2C_FAST_CLOCK);
+}
+
+void sensorConfigure(averageMode avg, convTime ctShunt, convTime ctBus) {
+  for (byte i = 0; i < channelCount; i++) {
+    devices[i].setAverage(avg);
+    devices[i].setConversionTime(ctShunt, ctBus);
+  }
+  // all devices have the same settings
+  confTrigger = (readINA226Register(addresses[0], INA226_CONF_REGISTER) & ~INA226_MODE_MASK) | INA226_MODE_TRIGGERED;
+}
+
+void sensorStartTriggered() {
+  for (byte i = 0; i < channelCount; i++) {
+    devices[i].setMeasureMode(TRIGGERED);
+  }
+}
+
+void sensorStartContinuous() {
+  // only the ALERT pin of the first device is connected; the others are read along with it
+  devices[0].enableConvReadyAlert();
+  devices[0].enableAlertLatch();
+  for (byte i = 0; i < channelCount; i++) {
+    devices[i].setMeasureMode(CONTINUOUS);
+  }
+}
+
+void sensorAcquire(Sample &s) {
+  // start all conversions first, then collect the results; the devices were triggered one after
+  // the other, so they finish in the same order
+  for (byte i = 0; i < channelCount; i++) {
+    writeINA226Register(addresses[i], INA226_CONF_REGISTER, confTrigger);
+  }
+  s.flags = 0;
+  for (byte i = 0; i < channelCount; i++) {
+    // reading Mask/Enable clears the conversion ready flag
+    uint16_t maskEnable;
+    do {
+      maskEnable = readINA226Register(addresses[i], INA226_MASK_ENABLE_REGISTER);
+    } while (!(maskEnable & INA226_CONVERSION_READY_FLAG));
+    if (i == 0) {
+      s.millis = millis();
+      s.micros = micros();
+    }
+    ChannelSample &c = s.ch[i];
+    c.shuntRaw = readINA226Register(addresses[i], INA226_SHUNT_REGISTER);
+    c.busRaw = readINA226Register(addresses[i], INA226_BUS_REGISTER);
+    if (!deriveCurrentPower(c, calibration[i]) || (maskEnable & INA226_MATH_OVERFLOW_FLAG)) {
+      s.flags |= SAMPLE_OVERFLOW << i;
+    }
+  }
+}
+
+static volatile bool alertSeen;
+static byte sleepAlertPin;
+
+static void onSleepAlert() {
+  detachInterrupt(digitalPinToInterrupt(sleepAlertPin));
+  alertSeen = true;
+}
+
+void sensorSleepUntilAlert(uint16_t function, uint16_t limit, byte alertPin) {
+  uint16_t conf = confTrigger & ~INA226_MODE_MASK;
+  for (byte i = 1; i < channelCount; i++) {
+    writeINA226Register(addresses[i], INA226_CONF_REGISTER, conf | INA226_MODE_POWER_DOWN);
+  }
+  uint16_t mode = INA226_MODE_CONTINUOUS;
+  if (function & (ALERT_SHUNT_OVER | ALERT_SHUNT_UNDER)) {
+    mode = INA226_MODE_SHUNT_CONTINUOUS;
+  }
+  else if (function & ALERT_BUS_OVER) {
+    mode = INA226_MODE_BUS_CONTINUOUS;
+  }
+  writeINA226Register(addresses[0], INA226_ALERT_LIMIT_REGISTER, limit);
+  writeINA226Register(addresses[0], INA226_MASK_ENABLE_REGISTER, function | INA226_ALERT_LATCH);
+  writeINA226Register(addresses[0], INA226_CONF_REGISTER, conf | mode);
+
+  // STANDBY stops the peripheral clock and with it the millis() timer, whose tick would wake the
+  // MCU every millisecond in IDLE; millis() and micros() stand still while asleep. Only a pin
+  // interrupt sensing both edges or a level wakes the MCU from STANDBY on pins which are not
+  // fully asynchronous, so ALERT gets a low level interrupt; the falling edge of the RTC square
+  // wave does not wake it. The interrupt detaches itself, as it would fire again and again.
+  Serial.flush();
+  pinMode(alertPin, INPUT_PULLUP);
+  sleepAlertPin = alertPin;
+  alertSeen = false;
+  attachInterrupt(digitalPinToInterrupt(alertPin), onSleepAlert, LOW);
+  set_sleep_mode(SLEEP_MODE_STANDBY);
+  noInterrupts();
+  while (!alertSeen) {
+    sleep_enable();
+    // the instruction after sei runs before any interrupt, so the alert cannot slip in between
+    interrupts();
+    sleep_cpu();
+    sleep_disable();
+    noInterrupts();
+  }
+  interrupts();
+
+  // disables the alert function; reading Mask/Enable releases ALERT
+  writeINA226Register(addresses[0], INA226_MASK_ENABLE_REGISTER, 0);
+  readINA226Register(addresses[0], INA226_MASK_ENABLE_REGISTER);
+}
+
+bool storageBegin(int chipSelect) {
+  return SD.begin(chipSelect);
+}
+
+// a command of the SD library in the middle of the multi-block write of a contiguous logfile
+// would corrupt both files
+bool storageExists(const char *name) {
+  return !storageContiguousStreaming() && SD.exists(name);
+}
+
+bool storageRemove(const char *name) {
+  return !storageContiguousStreaming() && SD.remove(name);
+}
+
+File storageOpen(const char *name, uint8_t mode) {
+  return storageContiguousStreaming() ? File() : SD.open(name, mode);
+}
+
+File storageOpenUpdate(const char *name) {
+  // without O_APPEND and O_CREAT, SD.open() leaves the position at 0
+  return storageContiguousStreaming() ? File() : SD.open(name, O_READ | O_WRITE);
+}
+
+// this works on the Arduino Nano Every; compatibility with other boards is not guaranteed
+void reboot() { asm volatile ("jmp 0"); }
+
+// from the linker script and avr-libc's malloc
+extern char __data_start, __bss_end, __heap_start;
+extern char *__brkval;
+
+const byte RAM_PAINT = 0xA5;
+// the highest end of the heap seen; the SD library frees its file objects on close, which lowers
+// __brkval below bytes that are no longer painted
+static char *paintFloor;
+
+static char *heapEnd() {
+  return __brkval ? __brkval : &__heap_start;
+}
+
+void ramPaint() {
+  paintFloor = heapEnd();
+  // SP points at the first free byte below the stack; an interrupt would push its registers
+  // there while we paint it
+  noInterrupts();
+  for (char *p = paintFloor, *end = (char *)(uintptr_t)SP - 16; p < end; p++) {
+    *p = RAM_PAINT;
+  }
+  interrupts();
+}
+
+void ramUsage(RamUsage &r) {
+  char *heap = heapEnd();
+  if (heap > paintFloor) {
+    paintFloor = heap;
+  }
+  char *p = paintFloor;
+  char *sp = (char *)(uintptr_t)SP;
+  while (p < sp && *(volatile byte *)p == RAM_PAINT) {
+    p++;
+  }
+  r.total = RAMEND - RAMSTART + 1;
+  r.staticBytes = &__bss_end - &__data_start;
+  r.heapBytes = paintFloor - &__heap_start;
+  r.stackBytes = (char *)RAMEND - p + 1;
+  r.headroomBytes = p - paintFloor;
+}
@@ -0,0 +1,143 @@
+#include "logencoder.h"
+
+// the state the next sample is encoded against
+static uint32_t sampleCount;
+static byte channelCount;
+static unsigned long prevMillis;
+static unsigned long prevMicros;
+static uint32_t prevDt;
+static ChannelSample prev[MAX_CHANNELS];
+
+void encoderBegin(unsigned long startMillis, unsigned long startMicros, byte channels) {
+  sampleCount = 0;
+  channelCount = channels;
+  prevMillis = startMillis;
+  prevMicros = startMicros;
+  prevDt = 0;
+  memset(prev, 0, sizeof(prev));
+}
+
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static uint8_t putVarint(uint8_t *p, uint32_t v) {
+  uint8_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+static void writeKeyframe(Print &out) {
+  LogKeyframe k;
+  memcpy(k.sync, LOG_KEYFRAME_SYNC, sizeof(k.sync));
+  k.sample = sampleCount;
+  k.millis = prevMillis;
+  k.micros = prevMicros;
+  k.dt = prevDt;
+  k.busRaw = prev[0].busRaw;
+  k.shuntRaw = prev[0].shuntRaw;
+  k.currentRaw = prev[0].currentRaw;
+  k.powerRaw = prev[0].powerRaw;
+  k.checksum = logChecksum((const uint8_t *)&k, sizeof(k) - 1);
+  out.write((const uint8_t *)&k, sizeof(k));
+  for (byte i = 1; i < channelCount; i++) {
+    LogKeyframeChannel c;
+    c.busRaw = prev[i].busRaw;
+    c.shuntRaw = prev[i].shuntRaw;
+    c.currentRaw = prev[i].currentRaw;
+    c.powerRaw = prev[i].powerRaw;
+    c.checksum = logChecksum((const uint8_t *)&c, sizeof(c) - 1);
+    out.write((const uint8_t *)&c, sizeof(c));
+  }
+}
+
+// encodes the fields of one channel; dtField is the zigzag encoded dt difference, or -1 for
+// the channels after the first, which have no dt field
+static void writeChannel(Print &out, const Sample &s, byte i, int32_t dtField) {
+  const ChannelSample &c = s.ch[i];
+  uint32_t fields[LOG_FIELDS] = {
+    (uint32_t)dtField,
+    zigzag((int32_t)c.busRaw - prev[i].busRaw),
+    zigzag((int32_t)c.shuntRaw - prev[i].shuntRaw),
+    zigzag((int32_t)c.currentRaw - prev[i].currentRaw),
+    zigzag((int32_t)c.powerRaw - prev[i].powerRaw)
+  };
+
+  uint8_t buffer[LOG_MAX_SAMPLE_BYTES];
+  uint8_t tag = (s.flags & (SAMPLE_OVERFLOW << i)) ? LOG_TAG_OVERFLOW : 0;
+  uint8_t n = 1;
+  bool highNibble = false;
+  for (uint8_t f = dtField < 0 ? 1 : 0; f < LOG_FIELDS; f++) {
+    if (fields[f] < 16) {
+      tag |= 1 << f;
+      if (highNibble) {
+        buffer[n++] |= fields[f] << 4;
+      } else {
+        buffer[n] = fields[f];
+      }
+      highNibble = !highNibble;
+    }
+  }
+  if (highNibble) {
+    n++;
+  }
+  for (uint8_t f = dtField < 0 ? 1 : 0; f < LOG_FIELDS; f++) {
+    if (!(tag & (1 << f))) {
+      n += putVarint(buffer + n, fields[f]);
+    }
+  }
+  buffer[0] = tag;
+  out.write(buffer, n);
+  prev[i] = c;
+}
+
+void encoderWriteSample(Print &out, const Sample &s) {
+  // modulo 2^32 and 2^16, the reader adds them up the same way
+  uint32_t dt = s.micros - prevMicros;
+  // the zigzag value of the dt difference fits 31 bits unless dt jumps by 2^30us (17 minutes) or
+  // more; a keyframe then carries the new dt, so the difference is 0
+  bool jump = zigzag((int32_t)(dt - prevDt)) > 0x7FFFFFFFUL;
+  if (jump) {
+    prevDt = dt;
+  }
+  if (sampleCount % LOG_KEYFRAME_INTERVAL == 0 || jump) {
+    writeKeyframe(out);
+  }
+  writeChannel(out, s, 0, zigzag((int32_t)(dt - prevDt)));
+  for (byte i = 1; i < channelCount; i++) {
+    writeChannel(out, s, i, -1);
+  }
+
+  sampleCount++;
+  prevMillis = s.millis;
+  prevMicros += dt;
+  prevDt = dt;
+}
+
+void encoderWriteGap(Print &out, uint32_t firstSlot, uint32_t slots) {
+  uint8_t buffer[11];
+  buffer[0] = LOG_TAG_GAP;
+  uint8_t n = 1;
+  n += putVarint(buffer + n, firstSlot);
+  n += putVarint(buffer + n, slots);
+  out.write(buffer, n);
+}
+
+void encoderWriteRate(Print &out, uint32_t delaytime, uint16_t averageMode, uint16_t convTimes) {
+  uint8_t buffer[14];
+  buffer[0] = LOG_TAG_RATE;
+  uint8_t n = 1;
+  n += putVarint(buffer + n, delaytime);
+  n += putVarint(buffer + n, averageMode);
+  n += putVarint(buffer + n, convTimes);
+  out.write(buffer, n);
+}
+
+void encoderWriteTrailer(Print &out, const LogTrailer &trailer) {
+  out.write((uint8_t)LOG_TAG_TRAILER);
+  out.write((const uint8_t *)&trailer, sizeof(trailer));
+}
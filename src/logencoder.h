@@ -0,0 +1,14 @@
+#pragma once
+// Writes samples in the delta encoding of binary logfiles (log format 2), see LOG_ENCODING_DELTA
+// in logformat.h
+
+#include "hal.h"
+#include "logformat.h"
+
+// starts the stream of a logfile with the given number of INA226 channels; the first sample is
+// encoded against startMicros
+void encoderBegin(unsigned long startMillis, unsigned long startMicros, byte channels);
+void encoderWriteSample(Print &out, const Sample &s);
+void encoderWriteGap(Print &out, uint32_t firstSlot, uint32_t slots);
+void encoderWriteRate(Print &out, uint32_t delaytime, uint16_t averageMode, uint16_t convTimes);
+void encoderWriteTrailer(Print &out, const LogTrailer &trailer);
@@ -0,0 +1,170 @@
+#pragma once
+// Binary logfile format (logNNNNN.bin)
+//
+// This header is shared by the firmware and the host side tools in tools/, so it
+// must only use fixed width types and no Arduino specific definitions.
+//
+// A binary logfile starts with one LogHeader, followed by LogRecords until the end of
+// the file (LOG_ENCODING_FIXED), or by the delta encoded stream described below
+// (LOG_ENCODING_DELTA). All values are little endian (AVR and x86/ARM hosts are little endian as well),
+// floats are 32 bit IEEE 754.
+//
+// The records contain the raw INA226 register values; the calibration needed to turn them
+// into Volts, mA and mW is stored in the header. tools/logdecode.cpp converts a binary
+// logfile into the same CSV columns the logger writes in CSV mode.
+
+#include <stdint.h>
+
+#define LOG_MAGIC "PLOG"
+#define LOG_FORMAT_VERSION 1
+// number of INA226 channels a header can describe
+#define LOG_MAX_CHANNELS 4
+
+// LogRecord.dtStatus: the lower 30 bits contain the time delta in microseconds to the previous record
+// (or to LogHeader.startMicros for the first record, see LOG_TIME_RTC), the top bits are status bits.
+#define LOG_STATUS_OVERFLOW 0x80000000UL
+#define LOG_STATUS_GAP      0x40000000UL
+#define LOG_DT_MASK         0x3FFFFFFFUL
+#define LOG_STATUS_TRAILER  (LOG_STATUS_OVERFLOW | LOG_STATUS_GAP)
+#define LOG_STATUS_RATE     (LOG_STATUS_TRAILER | 1)
+
+// A record with LOG_STATUS_GAP is no measurement: acquisition mode 0 skipped slots after an
+// overrun. busRaw/shuntRaw hold the low/high word of the first skipped slot, currentRaw/powerRaw
+// the low/high word of the number of skipped slots; its delta is 0.
+//
+// With more than one channel (LogHeader.channels) each measurement takes one record per channel,
+// in channel order; only the first carries the delta, the others have a delta of 0.
+//
+// A record with LOG_STATUS_RATE is no measurement either: the sampling rate changed, see burst.h.
+// busRaw/shuntRaw hold the low/high word of the new delaytime, currentRaw the INA226 AVG enum,
+// powerRaw the shunt CT enum in the low and the bus CT enum in the high byte; they apply to the
+// records which follow. The slots of gap records count at the rate in effect.
+//
+// A record with LOG_STATUS_TRAILER and otherwise 0 is followed by a LogTrailer when the logfile is
+// closed. A file without it ended with a power loss or a full pre-allocated file.
+//
+// The deltas are microseconds of the firmware's time base: with LOG_TIME_RTC it follows the 1Hz
+// square wave of the RTC, so the time of a record is the start time in the header plus
+// startOffsetMicros plus the sum of the deltas, with the accuracy of the RTC. With LOG_TIME_MICROS
+// the deltas are those of micros() and the start time is only accurate to a second.
+#define LOG_TIME_MICROS 0
+#define LOG_TIME_RTC    1
+
+struct __attribute__((packed)) LogHeader {
+  char     magic[4];          // LOG_MAGIC, not 0 terminated
+  uint8_t  version;           // LOG_FORMAT_VERSION
+  uint8_t  headerSize;        // sizeof(LogHeader), lets readers skip unknown header extensions
+  uint8_t  recordSize;        // sizeof(LogRecord), 0 with LOG_ENCODING_DELTA
+  uint8_t  rtcValid;          // 1 if the start time below was read from the RTC without error
+  float    shuntResistor;     // Ohm, as passed to setResistorRange()
+  float    currentRange;      // A, as passed to setResistorRange()
+  float    correctionFactor;  // as passed to setCorrectionFactor()
+  uint32_t delaytime;         // configured time between two measurements in microseconds
+  uint16_t averageMode;       // INA226 AVG enum in use
+  uint16_t convTime;          // INA226 shunt voltage CT enum in use
+  uint16_t year;              // RTC start time of the measurement cycle
+  uint8_t  month;
+  uint8_t  day;
+  uint8_t  hour;
+  uint8_t  minute;
+  uint8_t  second;
+  uint8_t  encoding;          // LOG_ENCODING_FIXED or LOG_ENCODING_DELTA
+  uint32_t startMillis;       // millis() and micros() of the first record, i.e. of the oldest pre-trigger
+  uint32_t startMicros;       // record, or of the sample which started the measurement cycle
+  uint32_t firstSlot;         // acquisition mode 0: slot of the sample which started the measurement cycle,
+                              // slot n is due delaytime*n after t0
+  uint32_t overheadMicros;    // time budgeted for the cycle besides the conversion, see calibrateOverhead()
+  uint16_t busConvTime;       // INA226 bus voltage CT enum in use
+  uint8_t  channels;          // number of INA226 devices, 1..LOG_MAX_CHANNELS
+  uint8_t  channelAddress[LOG_MAX_CHANNELS];  // their I2C addresses, 0 for unused entries
+  uint16_t pretriggerSamples; // number of measurements from the pre-trigger buffer ahead of the one which
+                              // started the measurement cycle; they have no gap records
+  uint8_t  timeSource;        // LOG_TIME_MICROS or LOG_TIME_RTC
+  uint32_t startOffsetMicros; // time of the first record after the start time above (year..second)
+};
+
+struct __attribute__((packed)) LogRecord {
+  uint32_t dtStatus;          // see LOG_STATUS_OVERFLOW / LOG_DT_MASK
+  uint16_t busRaw;            // INA226 bus voltage register, LSB 1.25mV
+  int16_t  shuntRaw;          // INA226 shunt voltage register, LSB 2.5uV
+  int16_t  currentRaw;        // INA226 current register, LSB currentRange/32768
+  uint16_t powerRaw;          // INA226 power register, LSB 25 * current LSB
+};
+
+struct __attribute__((packed)) LogTrailer {
+  int64_t  chargeRaw;         // sum of -currentRaw x microseconds over the logfile, i.e. the sign of Current_mA
+  int64_t  energyRaw;         // sum of powerRaw x microseconds, with the sign of the current
+  float    totalCharge_mAh;   // charge and energy totals since LOGGER.INI was created, as saved there
+  float    totalEnergy_Wh;
+};
+
+// LOG_ENCODING_DELTA
+//
+// Consecutive samples differ little, so each sample is stored as the difference to the previous
+// one: the micros() delta minus the previous delta, and the four register values minus the
+// previous ones. The differences are zigzag encoded (0, -1, 1, -2, ... -> 0, 1, 2, 3, ...); values
+// below 16 take a nibble, the others an unsigned LEB128 varint. A sample is
+//   tag byte: bit i (i = 0..4 for dt, bus, shunt, current, power) set if field i is a nibble,
+//             LOG_TAG_OVERFLOW if the INA226 reported an overflow
+//   the nibbles of the fields with their bit set, in field order, low nibble first, padded to a byte
+//   the varints of the other fields, in field order
+// A steady load takes 4 bytes per sample instead of 12. With more than one channel the sample is
+// followed by the same for every further channel, without the dt field (bit 0 of the tag is 0).
+// Other tags:
+//   LOG_TAG_GAP      varints of the first skipped slot and the number of skipped slots
+//   LOG_TAG_RATE     varints of the new delaytime, the AVG enum and the CT enums as in LOG_STATUS_RATE
+//   LOG_TAG_TRAILER  a LogTrailer, the end of the data
+//   LOG_TAG_KEYFRAME the rest of a LogKeyframe
+// A LogKeyframe, followed by a LogKeyframeChannel for every further channel, precedes every
+// LOG_KEYFRAME_INTERVAL-th sample, starting with the first. It holds the state the next sample is
+// encoded against, so a reader can start over at any keyframe after
+// damaged data, e.g. the stale data after the last sector of a pre-allocated file after a power loss.
+// A sample whose dt differs by 2^30 or more from the previous one, whose difference would not fit
+// 31 bits, gets a keyframe of its own, with its dt in place of the previous one.
+#define LOG_ENCODING_FIXED    0
+#define LOG_ENCODING_DELTA    1
+#define LOG_FIELDS            5
+#define LOG_TAG_OVERFLOW      0x20
+#define LOG_TAG_GAP           0x40
+#define LOG_TAG_TRAILER       0x41
+#define LOG_TAG_RATE          0x42
+#define LOG_TAG_KEYFRAME      0x80
+#define LOG_KEYFRAME_SYNC     "\x80KEY"
+#define LOG_KEYFRAME_INTERVAL 256
+// tag, 5 nibbles or 5 varints of at most 5 bytes
+#define LOG_MAX_SAMPLE_BYTES  26
+
+struct __attribute__((packed)) LogKeyframe {
+  char     sync[4];           // LOG_KEYFRAME_SYNC, the first byte is LOG_TAG_KEYFRAME
+  uint32_t sample;            // number of samples before this keyframe
+  uint32_t millis;            // startMillis/startMicros advanced by the deltas up to the previous sample
+  uint32_t micros;
+  uint32_t dt;                // delta of the previous sample, or of the next after a jump, see above
+  uint16_t busRaw;            // register values of the previous sample, 0 at first
+  int16_t  shuntRaw;
+  int16_t  currentRaw;
+  uint16_t powerRaw;
+  uint8_t  checksum;          // logChecksum() of the bytes above
+};
+
+struct __attribute__((packed)) LogKeyframeChannel {
+  uint16_t busRaw;            // register values of the previous sample of the channel
+  int16_t  shuntRaw;
+  int16_t  currentRaw;
+  uint16_t powerRaw;
+  uint8_t  checksum;          // logChecksum() of the bytes above
+};
+
+static inline uint8_t logChecksum(const uint8_t *data, uint32_t size) {
+  uint8_t sum = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    sum = (uint8_t)((sum << 1) | (sum >> 7)) + data[i];
+  }
+  return sum;
+}
+
+static_assert(sizeof(LogHeader) == 66, "LogHeader layout changed, bump LOG_FORMAT_VERSION");
+static_assert(sizeof(LogRecord) == 12, "LogRecord layout changed, bump LOG_FORMAT_VERSION");
+static_assert(sizeof(LogTrailer) == 24, "LogTrailer layout changed, bump LOG_FORMAT_VERSION");
+static_assert(sizeof(LogKeyframe) == 29, "LogKeyframe layout changed, bump LOG_FORMAT_VERSION");
+static_assert(sizeof(LogKeyframeChannel) == 9, "LogKeyframeChannel layout changed, bump LOG_FORMAT_VERSION");
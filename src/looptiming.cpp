@@ -0,0 +1,126 @@
+#include "looptiming.h"
+
+struct PhaseStats {
+  unsigned long count;
+  unsigned long minMicros;
+  unsigned long maxMicros;
+  // 16 bit to save RAM; when a bucket is full, all buckets of the phase are halved
+  uint16_t buckets[TIMING_BUCKETS];
+};
+
+static PhaseStats stats[PHASE_COUNT];
+static unsigned long cycleStart;
+static unsigned long phaseStart;
+
+const char PHASE_NAMES[PHASE_COUNT][8] PROGMEM = {
+  "acquire", "process", "write", "flush", "serial", "cycle"
+};
+
+static uint8_t bucketOf(unsigned long us) {
+  uint8_t b = 0;
+  if (us >> 16) {
+    b = 16;
+    us >>= 16;
+  }
+  if (us >> 8) {
+    b += 8;
+    us >>= 8;
+  }
+  while (us >>= 1) {
+    b++;
+  }
+  return min(b, (uint8_t)(TIMING_BUCKETS - 1));
+}
+
+static void record(TimingPhase phase, unsigned long us) {
+  PhaseStats &p = stats[phase];
+  if (p.count == 0 || us < p.minMicros) {
+    p.minMicros = us;
+  }
+  if (us > p.maxMicros) {
+    p.maxMicros = us;
+  }
+  p.count++;
+  uint8_t b = bucketOf(us);
+  if (p.buckets[b] == 0xFFFF) {
+    for (uint8_t i = 0; i < TIMING_BUCKETS; i++) {
+      p.buckets[i] >>= 1;
+    }
+  }
+  p.buckets[b]++;
+}
+
+void timingBegin() {
+  cycleStart = micros();
+  phaseStart = cycleStart;
+}
+
+void timingMark(TimingPhase phase) {
+  unsigned long now = micros();
+  record(phase, now - phaseStart);
+  phaseStart = now;
+}
+
+void timingSkip() {
+  phaseStart = micros();
+}
+
+void timingRecord(TimingPhase phase, unsigned long us) {
+  record(phase, us);
+}
+
+unsigned long timingEnd() {
+  unsigned long us = micros() - cycleStart;
+  record(PHASE_CYCLE, us);
+  return us;
+}
+
+void timingReset() {
+  memset(stats, 0, sizeof(stats));
+}
+
+// upper bound of the bucket which holds the given fraction (in percent) of the samples
+static unsigned long percentile(const PhaseStats &p, uint8_t percent) {
+  unsigned long total = 0;
+  for (uint8_t i = 0; i < TIMING_BUCKETS; i++) {
+    total += p.buckets[i];
+  }
+  unsigned long needed = (total * percent + 99) / 100;
+  unsigned long sum = 0;
+  uint8_t b = 0;
+  while (b < TIMING_BUCKETS - 1) {
+    sum += p.buckets[b];
+    if (sum >= needed) {
+      break;
+    }
+    b++;
+  }
+  unsigned long upper = (2UL << b) - 1;
+  return max(p.minMicros, min(upper, p.maxMicros));
+}
+
+unsigned long timingPercentile(TimingPhase phase, uint8_t percent) {
+  return percentile(stats[phase], percent);
+}
+
+void timingReport(Print &out) {
+  out.println(F("phase,count,min_us,p50_us,p99_us,max_us"));
+  for (uint8_t i = 0; i < PHASE_COUNT; i++) {
+    const PhaseStats &p = stats[i];
+    out.print((const __FlashStringHelper *)PHASE_NAMES[i]); out.print(",");
+    out.print(p.count);                                     out.print(",");
+    out.print(p.minMicros);                                 out.print(",");
+    out.print(percentile(p, 50));                           out.print(",");
+    out.print(percentile(p, 99));                           out.print(",");
+    out.println(p.maxMicros);
+  }
+  out.println(F("histogram, bucket k counts 2^k..2^(k+1)-1 us"));
+  for (uint8_t i = 0; i < PHASE_COUNT; i++) {
+    out.print((const __FlashStringHelper *)PHASE_NAMES[i]);
+    for (uint8_t b = 0; b < TIMING_BUCKETS; b++) {
+      out.print(",");
+      out.print(stats[i].buckets[b]);
+    }
+    out.println();
+  }
+}
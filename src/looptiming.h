@@ -0,0 +1,38 @@
+#pragma once
+// Per-phase timing of the measurement cycle
+//
+// The cycle is split into phases; timingMark() puts the time since the previous mark into
+// the histogram of the given phase. The histograms have log2 buckets, bucket k counts
+// durations of 2^k .. 2^(k+1)-1 microseconds (bucket 0 also counts 0), the last bucket
+// everything above. Recording costs a micros() call and a few shifts, so it is always on.
+
+#include "hal.h"
+
+enum TimingPhase {
+  PHASE_ACQUIRE,  // triggering and reading the INA226 (acquisition mode 0)
+  PHASE_PROCESS,  // scaling, state machine, opening and closing logfiles
+  PHASE_WRITE,    // writing the record to the logfile
+  PHASE_FLUSH,    // sector commits and flushes in the slack time, see writeback.h; outside of the cycle
+  PHASE_SERIAL,   // printing the measurement to Serial
+  PHASE_CYCLE,    // from timingBegin() to timingEnd()
+  PHASE_COUNT
+};
+
+#define TIMING_BUCKETS 20
+
+// starts a cycle and the first phase
+void timingBegin();
+// ends the current phase and starts the next one
+void timingMark(TimingPhase phase);
+// starts the next phase without recording the current one, e.g. if nothing was flushed
+void timingSkip();
+// records a duration measured outside of the cycle
+void timingRecord(TimingPhase phase, unsigned long us);
+// records the whole cycle and returns its duration in microseconds
+unsigned long timingEnd();
+void timingReset();
+// upper bound of the bucket which holds the given percentile of the phase, at most its maximum
+unsigned long timingPercentile(TimingPhase phase, uint8_t percent);
+// count, min, p50, p99 and max of every phase, followed by the histograms; p50 and p99 are
+// the upper bounds of the buckets holding them
+void timingReport(Print &out);
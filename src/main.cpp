@@ -1,26 +1,59 @@
-#include <Arduino.h>
-#include <Wire.h>
-#include <INA226_WE.h>
-#include <SPI.h>
-#include <SD.h>
-#include <RtcDS1307.h>
-#include <avr/pgmspace.h>
+#include "aggregate.h"
+#include "burst.h"
+#include "csvrow.h"
+#include "hal.h"
+#include "logencoder.h"
+#include "logformat.h"
+#include "looptiming.h"
+#include "pretrigger.h"
+#include "sdbench.h"
+#include "sampler.h"
+#include "stream.h"
+#include "timebase.h"
+#include "writeback.h"
 
-extern RtcDS1307<TwoWire> Rtc;
-extern void printDateTime(const RtcDateTime& dt);
-extern bool wasError(const char* errorTopic = "");
-extern void rtcsetup (char const *compile_date, char const *compile_time); 
 
-
-// for INA226
+// for INA226; the address of a single device, LOGGER.INI line 13 can list several
 #define I2C_ADDRESS 0x40
-INA226_WE ina226 = INA226_WE(I2C_ADDRESS);
+// INA226 devices in use and their I2C addresses, read from the INI file; all use the same
+// shunt and the same settings, the first one paces acquisition mode 2
+byte channelCount=1;
+byte channelAddresses[MAX_CHANNELS]={I2C_ADDRESS};
+
+// the "red" module/shield uses a 0.002 Ohm shunt and supports measurements up to 20A
+const float shuntResistor = 0.002;
+const float currentRange = 20.0;
+// correction factor for my "red" module/shield 
+const float correctionFactor = 0.947818013;
+// LSB of the current register in mA, see setResistorRange() in INA226_WE
+const float currentLSB_mA = currentRange * 1000.0 / 32768.0;
+
+// INA226 ALERT pin, used by acquisition mode 2
+const int alertPin = 2;
+// SQW/OUT pin of the DS1307, the 1Hz square wave of the time base, see timebase.h
+const int sqwPin = 3;
 
 // for SPI bus used by Data Logging Module, i.e. SD Card and RTC
 const int chipSelect = 10; // D10; seems to correspond to D13 on Nano Every
 
 const char INIfilename[] = "LOGGER.INI";
+// the INI file has INI_LINES lines of INI_LINE_CHARS characters plus CR LF, see writeIniFile()
+const byte INI_LINES=22;
+const byte INI_LINE_CHARS=22;
+const uint16_t INI_FILE_SIZE=INI_LINES*(INI_LINE_CHARS+2);
 File logfile;
+// the log data goes either to logfile, or to a pre-allocated, contiguous logfile; in both
+// cases through writeBack, which moves the SD card work into the slack time
+Print *logout = &writeBack;
+bool contiguous = false;
+// the logfile of the next measurement cycle is open already, see stageLogfile()
+bool logfileStaged = false;
+// RTC time read in standby and the millis() of the read, see refreshClock()
+DateTime clockTime;
+bool clockValid = false;
+unsigned long clockMillis;
+// how long reading the RTC takes, measured
+unsigned long rtcMicros = 1000;
 
 // iter is the logfile "generation", a sequence number which 
 // is increased with each logfile produced
@@ -47,15 +80,122 @@ float freq=1.0;
 
 //delaytime is the time between two measurements, i.e. is calculated as 1 / freq (in microseconds). 
 unsigned long delaytime;
+// time between two records in the logfile, 1 / freq in microseconds; the same as delaytime unless
+// the samples are aggregated
+unsigned long logInterval;
+
+// log format, read from the INI file: 0 = CSV (logNNNNN.csv), 1 = binary (logNNNNN.bin, see logformat.h),
+// 2 = delta encoded binary (logNNNNN.bin, see logencoder.h)
+int logFormat=0;
+// acquisition mode, read from the INI file: 0 = trigger and wait for each measurement in loop(), 
+// 1 = timer interrupt and sample buffer, 2 = CONTINUOUS mode, ALERT interrupt and sample buffer, see sampler.h
+int acquisitionMode=0;
+// size of pre-allocated logfiles in MB, read from the INI file; 0 = the logfile grows through the SD library
+int preallocMB=0;
+// what acquisition mode 0 does after an overrun, read from the INI file: 0 = skip the slots whose
+// deadline has passed, 1 = burst, i.e. measure back to back until we are back on schedule
+int catchUpPolicy=0;
+// weight of the shunt voltage conversion time when AVG and the CTs are chosen, read from the INI
+// file: 0 = bus and shunt use the same CT, N = maximise AVG x (N x shunt CT + bus CT), see
+// findEnumsMaxProductBelowThreshold()
+byte shuntWeight=0;
+// aggregation, read from the INI file: 0 = one record per measurement, 1 = measure as fast as
+// possible and write one row with min/mean/max/RMS per logInterval, see aggregate.h
+int aggregation=0;
+// with more than one channel, read from the INI file: 0 = logging starts when the threshold
+// conditions are met on any channel, 1 = when they are met on all channels
+int triggerPolicy=0;
+// number of samples taken in standby which are written ahead of the sample that started the
+// logfile, read from the INI file; limited to what fits into the pre-trigger buffer, see pretrigger.h
+unsigned int pretriggerSamples=0;
+// serial output, read from the INI file: 0 = a line of text per measurement if there is time for it,
+// 1 = every sample as a binary frame, see stream.h and tools/streamrecv.cpp
+int serialStream=0;
+// read from the INI file: 1 = benchmark the SD card once at the next power-up, see sdbench.h
+int sdBenchmarkRun=0;
+// read from the INI file: 1 = in standby the MCU sleeps until the INA226 alert trips, see standbySleep()
+int lowPowerStandby=0;
+// adaptive sampling rate, read from the INI file, see burst.h: the burst frequency (0 = off), the hold
+// time, and the current and bus voltage steps between two samples which start a burst (0 = not checked)
+float burstFreq=0.0;
+unsigned long burstHoldMillis=1000;
+float burstCurrentStep_mA=0.0;
+float burstVoltageStep_V=0.0;
+// with catchUpPolicy 1 at most this many slots are measured late, the older ones are skipped
+const unsigned long MAX_BURST_SLOTS=8;
+// micros() of the previous record written to a binary logfile
+unsigned long LastRecordMicros;
+// millis(), micros() and time base time of the first record of the logfile, and the time base
+// time its rows count from, see toTimeBase()
+unsigned long logStartMillis, logStartMicros;
+TimeStamp logStart;
+TimeStamp logOrigin;
+// AVG and CTs applied to the INA226, kept for the binary logfile header
+averageMode avgResult;
+convTime ctShuntResult;
+convTime ctBusResult;
+// delaytime and INA226 settings of the configured frequency and of the burst frequency, see chooseRates()
+struct RateSettings {
+  unsigned long delaytime;
+  averageMode avg;
+  convTime ctShunt;
+  convTime ctBus;
+};
+RateSettings baseRate, burstRate;
+// the burst frequency is in use; RateChanged marks the change in the logfile ahead of the next record
+bool bursting=false;
+bool RateChanged=false;
+// bursts since the logfile was opened
+unsigned long burstCount=0;
 
 // Other global variables
 int SwitchTime=2.0;
 int MaxCycles;
 bool logging=false;
 char status[10];
-unsigned long StartOfLoopMicros;
+// acquisition mode 0 measures on a fixed grid: slot n is due at t0 + n*delaytime, NextDeadline is
+// the deadline of slot SlotIndex+1
+unsigned long SlotIndex=0;
+unsigned long NextDeadline;
+// slots skipped since the previous record, written to the logfile with the next record
+unsigned long GapFirstSlot, GapSlots=0;
+// number of slots skipped (acquisition mode 0)
+unsigned long missedSlots=0;
+// time a measurement cycle needs besides the INA226 conversion, in microseconds; measured on the
+// installed SD card by calibrateOverhead() and re-tuned at run time, see chooseSettings()
+unsigned long overheadMicros;
+// slack left in every cycle of acquisition mode 0 for the sector commits and flushes of writeBack,
+// 0 if they take more than half of delaytime; see chooseSettings()
+unsigned long sdReserveMicros=0;
+// running estimate of the 90th percentile of the overhead of the cycles which log (acquisition
+// mode 0); standby cycles write nothing, they would pull it down to the I2C time
+unsigned long overheadP90;
+// re-tune when the estimate is more than 1/OVERHEAD_DRIFT_RATIO away from overheadMicros
+const byte OVERHEAD_DRIFT_RATIO=4;
+const unsigned long OVERHEAD_STEP_MICROS=4;
+const byte CALIBRATION_SAMPLES=64;
+const char CALIBRATIONfilename[] = "CALIB.TMP";
+// free RAM between heap and stack below which setup() warns; the buffers in pretrigger.h and
+// sampler.h are sized by hand, the RAM report shows what is left for them
+const uint16_t MIN_RAM_HEADROOM=256;
 // used to count the number of cycles (not) meeeting the threshold conditions
 int CyclesCondMet=0, CyclesCondNotMet=0;
+// number of loops which took longer than delaytime (acquisition mode 0)
+unsigned long overruns=0;
+// number of pre-trigger samples at the start of the current logfile
+unsigned int pretriggerWritten=0;
+// charge and energy since power-up, integrated over every sample: -currentRaw x microseconds and
+// powerRaw x microseconds with the sign of the current of the first channel, see integrateSample()
+int64_t chargeRaw=0;
+int64_t energyRaw=0;
+// chargeRaw and energyRaw when the current logfile was opened
+int64_t chargeAtOpen, energyAtOpen;
+// totals of the earlier power-ups, read from the INI file
+float chargeBase_mAh=0.0;
+float energyBase_Wh=0.0;
+// micros() of the previous sample, for the integration
+unsigned long LastSampleMicros;
+bool integrating=false;
 
 
 /* 
@@ -75,6 +215,12 @@ function. The number of second level averages is controlled by the averageMode,
 The function findEnumsMaxProductBelowThreshold()searches for the maximum product of the 
 AVG and CT array components, which is below the delaytime. The results are then mapped to the 
 corresponding enum values used in the INA226_WE library.
+
+The bus and the shunt voltage have separate conversion times. The current is calculated from the
+shunt voltage only, so for current measurements a long shunt CT is worth more than a long bus CT.
+With a shuntWeight N > 0 the search covers AVG, shunt CT and bus CT and maximises
+AVG x (N x shunt CT + bus CT): N = 1 maximises the total conversion time, a large N the shunt
+integration time (and with it the current resolution) at the expense of the bus voltage.
 */
 const byte VECTOR_SIZE = 8;
 const byte MAX_IDX = VECTOR_SIZE - 1;
@@ -95,71 +241,637 @@ const unsigned int CT_ENUMS[VECTOR_SIZE] PROGMEM = {
     CONV_TIME_1100, CONV_TIME_2116, CONV_TIME_4156, CONV_TIME_8244
 };
 
-const long MIN_PRODUCT_VAL = 140L;       // Calculated from 1 * 140
-const long MAX_PRODUCT_VAL = 8441856L;   // Calculated from 1024 * 8244
-
-void findEnumsMaxProductBelowThreshold(long threshold, averageMode* result_avg_enum, convTime* result_ct_enum) {
+// value of the AVG or CT enum e in the enums/values table pair
+unsigned int enumValue(const unsigned int* enums, const unsigned int* values, unsigned int e) {
+    for (byte i = 0; i < VECTOR_SIZE; ++i) {
+        if (pgm_read_word_near(enums + i) == e) {
+            return pgm_read_word_near(values + i);
+        }
+    }
+    return pgm_read_word_near(values);
+}
 
-    threshold = threshold / 2.0;
+void findEnumsMaxProductBelowThreshold(long threshold, byte weight, averageMode* result_avg_enum,
+                                       convTime* result_ct_shunt_enum, convTime* result_ct_bus_enum) {
 
+    // a conversion takes AVG x (bus CT + shunt CT), i.e. 2 x AVG x CT with the same CT
+    // for both, so this has to be below the available time
     byte best_i = 0;
-    byte best_j = 0;
-
-    if (threshold <= MIN_PRODUCT_VAL) {
-        // Indices remain 0, 0
-    } else if (threshold >= MAX_PRODUCT_VAL) {
-        best_i = MAX_IDX;
-        best_j = MAX_IDX;
-    } else {
-        long maxProductBelowThreshold = MIN_PRODUCT_VAL;
+    byte best_s = 0;
+    byte best_b = 0;
+    unsigned long bestScore = 0;
 
-        for (byte i = 0; i < VECTOR_SIZE; ++i) {
-            unsigned int avg_val = pgm_read_word_near(AVG_VALUES + i);
+    for (byte i = 0; i < VECTOR_SIZE; ++i) {
+        unsigned long avg_val = pgm_read_word_near(AVG_VALUES + i);
 
-            for (byte j = 0; j < VECTOR_SIZE; ++j) {
-                unsigned int ct_val = pgm_read_word_near(CT_VALUES + j);
-                long currentProduct = (long)avg_val * (long)ct_val;
+        for (byte s = 0; s < VECTOR_SIZE; ++s) {
+            unsigned long ct_shunt = pgm_read_word_near(CT_VALUES + s);
 
-                if (currentProduct < threshold && currentProduct > maxProductBelowThreshold) {
-                    maxProductBelowThreshold = currentProduct;
+            // without a weight only the same CT for bus and shunt
+            for (byte b = weight ? 0 : s; b <= (weight ? MAX_IDX : s); ++b) {
+                unsigned long ct_bus = pgm_read_word_near(CT_VALUES + b);
+                unsigned long period = avg_val * (ct_shunt + ct_bus);
+                if ((long)period >= threshold) {
+                    continue;
+                }
+                unsigned long score = weight ? avg_val * (weight * ct_shunt + ct_bus) : period;
+                // on a tie the longer shunt CT
+                if (score > bestScore || (score == bestScore && s > best_s)) {
+                    bestScore = score;
                     best_i = i;
-                    best_j = j;
+                    best_s = s;
+                    best_b = b;
                 }
             }
         }
     }
 
     *result_avg_enum = (averageMode)pgm_read_word_near(AVG_ENUMS + best_i);
-    *result_ct_enum = (convTime)pgm_read_word_near(CT_ENUMS + best_j);
+    *result_ct_shunt_enum = (convTime)pgm_read_word_near(CT_ENUMS + best_s);
+    *result_ct_bus_enum = (convTime)pgm_read_word_near(CT_ENUMS + best_b);
+}
+
+// conversion time of the INA226 for the given enums in microseconds, bus and shunt voltage 
+// are converted one after the other, each with its CT, and this is repeated AVG times
+unsigned long conversionPeriodMicros(averageMode avg, convTime ctShunt, convTime ctBus) {
+    unsigned long avg_val = enumValue(AVG_ENUMS, AVG_VALUES, avg);
+    return avg_val * (enumValue(CT_ENUMS, CT_VALUES, ctShunt) + enumValue(CT_ENUMS, CT_VALUES, ctBus));
 }
 
 // used for INIFile ingestion
+// characters which do not fit into the buffer are skipped, e.g. of a line edited by hand, so
+// the next call starts with the next line; the padding of writeIniFile() fits
 void FileReadLn(File &ReadFile, char *buffer, size_t len) {
   size_t index = 0;
-  while (ReadFile.available() && index < len - 1) {
+  while (ReadFile.available()) {
       char c = ReadFile.read();
       if (c == '\n') {
           break;
       }
-      buffer[index++] = c;
+      if (index < len - 1) {
+          buffer[index++] = c;
+      }
   }
   buffer[index] = '\0';
 }
 
-// this works on the Arduino Nano Every; compatibility with other boards is not guaranteed
-void reboot() { asm volatile ("jmp 0"); }
+// sets the measured values of channel ch and the status of all channels from the raw register
+// values of a sample
+void scaleSample(const Sample &s, byte ch=0) {
+    const ChannelSample &c = s.ch[ch];
+    // Bus Voltage is measured between GND and V+ (of the module, VBUS of the INA226 chip)
+    // Shunt Voltage is measured between Current- and Current+
+    // the scaling is the same as in getBusVoltage_V(), getCurrent_mA(), getShuntVoltage_mV() and getBusPower()
+    busVoltage_V = c.busRaw * 0.00125;
+    current_mA = -c.currentRaw * currentLSB_mA;
+    shuntVoltage_mV = c.shuntRaw * 0.0025;
+    power_mW = c.powerRaw * 25.0 * currentLSB_mA;
+
+    // "loadVoltage" is the Bus Voltage minus the Shunt Voltage, subtracted in the shunt voltage LSB
+    loadVoltage_V  = loadVoltageRaw(c) * 0.0000025;
+
+    if(!s.flags){
+        strcpy(status,"ok");  
+        }
+    else{
+      strcpy(status,"overflow");  
+      }
+}
+
+// true if the threshold conditions are met on any channel, or with triggerPolicy 1 on all
+// channels; an overflow on any channel counts as met. Leaves the values of the first channel.
+bool thresholdsMet(const Sample &s) {
+    bool met = triggerPolicy==1;
+    for (byte ch=channelCount; ch-- > 0; ) {
+      scaleSample(s, ch);
+      bool channelMet = abs(busVoltage_V)>=busVoltageThreshold && abs(current_mA)>=currentThreshold;
+      met = triggerPolicy==1 ? met && channelMet : met || channelMet;
+      }
+    return met || s.flags;
+}
+
+// moves millis and micros of a sample onto the time base: the millis() and micros() of the first
+// record plus the time base time since it, see LOG_TIME_RTC in logformat.h
+void toTimeBase(Sample &s) {
+  TimeStamp t;
+  timebaseAt(s.micros, t);
+  uint32_t seconds, micros_;
+  timebaseSince(logStart, t, seconds, micros_);
+  s.millis=logStartMillis+seconds*1000+micros_/1000;
+  s.micros=logStartMicros+seconds*1000000+micros_;
+}
+
+// writes one measurement of all channels to a logfile
+void writeRecord(Print &out, const Sample &sample) {
+    if (logFormat==2) {
+      // around 4 bytes per sample
+      Sample s=sample;
+      toTimeBase(s);
+      encoderWriteSample(out, s);
+      }
+    else if (logFormat) {
+      // 12 bytes per sample instead of ~45 characters, no float formatting
+      LogRecord record;
+      Sample s=sample;
+      toTimeBase(s);
+      // unsigned subtraction handles the micros() rollover; a gap of more than 
+      // 17 minutes does not fit into 30 bits and is clamped
+      unsigned long dt=s.micros-LastRecordMicros;
+      LastRecordMicros=s.micros;
+      dt = min(dt, LOG_DT_MASK);
+      // one record per channel, the delta is on the first
+      for (byte ch=0; ch<channelCount; ch++) {
+        record.dtStatus = ch==0 ? dt : 0;
+        if (s.flags & (SAMPLE_OVERFLOW << ch)) {
+          record.dtStatus |= LOG_STATUS_OVERFLOW;
+          }
+        record.busRaw = s.ch[ch].busRaw;
+        record.shuntRaw = s.ch[ch].shuntRaw;
+        record.currentRaw = s.ch[ch].currentRaw;
+        record.powerRaw = s.ch[ch].powerRaw;
+        out.write((const uint8_t*)&record, sizeof(record));
+        }
+      }
+    else {
+      // formatted from the raw registers, without floats
+      csvWriteRow(out, sample);
+      }
+}
+
+// the charge and energy of the first channel over dt microseconds, in the units of chargeRaw and
+// energyRaw; negated like current_mA, the power register has no sign
+int64_t sampleCharge(const Sample &s, unsigned long dt) {
+  return -(int64_t)s.ch[0].currentRaw*dt;
+}
+
+int64_t sampleEnergy(const Sample &s, unsigned long dt) {
+  return (s.ch[0].currentRaw>0 ? -(int64_t)s.ch[0].powerRaw : (int64_t)s.ch[0].powerRaw)*dt;
+}
+
+// adds the charge and energy of the first channel since the previous sample; the INA226 averages over the conversion,
+// so the sample stands for the time since the previous one. With a low logging frequency the
+// conversion fills most of delaytime, with aggregation the samples come at the full rate.
+void integrateSample(const Sample &s) {
+  if (integrating) {
+    chargeRaw+=sampleCharge(s, s.micros-LastSampleMicros);
+    energyRaw+=sampleEnergy(s, s.micros-LastSampleMicros);
+    }
+  LastSampleMicros=s.micros;
+  integrating=true;
+}
+
+// mA x us -> mAh
+float chargeMilliAmpHours(int64_t raw) {
+  return (float)raw*currentLSB_mA/3.6e9;
+}
+
+// mW x us -> Wh
+float energyWattHours(int64_t raw) {
+  return (float)raw*25.0*currentLSB_mA/3.6e12;
+}
+
+// writes a sample to the open logfile, or adds it to the window of the aggregated row. True if
+// a record was written.
+bool logSample(const Sample &s) {
+  if (aggregation) {
+    bool written=false;
+    if (aggregateDue(s.micros, logInterval)) {
+      aggregateWrite(*logout, currentLSB_mA);
+      aggregateNext(s.micros, logInterval);
+      written=true;
+      }
+    aggregateAdd(s);
+    return written;
+    }
+  writeRecord(*logout, s);
+  return true;
+}
+
+// charge and energy of the logfile and the totals, at the end of the logfile
+void writeTrailer(Print &out) {
+  int64_t charge=chargeRaw-chargeAtOpen;
+  int64_t energy=energyRaw-energyAtOpen;
+  float chargeTotal_mAh=chargeBase_mAh+chargeMilliAmpHours(chargeRaw);
+  float energyTotal_Wh=energyBase_Wh+energyWattHours(energyRaw);
+  if (logFormat) {
+    LogTrailer trailer;
+    trailer.chargeRaw = charge;
+    trailer.energyRaw = energy;
+    trailer.totalCharge_mAh = chargeTotal_mAh;
+    trailer.totalEnergy_Wh = energyTotal_Wh;
+    if (logFormat==2) {
+      encoderWriteTrailer(out, trailer);
+      }
+    else {
+      LogRecord marker;
+      memset(&marker, 0, sizeof(marker));
+      marker.dtStatus = LOG_STATUS_TRAILER;
+      out.write((const uint8_t*)&marker, sizeof(marker));
+      out.write((const uint8_t*)&trailer, sizeof(trailer));
+      }
+    }
+  else {
+    out.print(F("Charge_mAh, "));  out.print(chargeMilliAmpHours(charge), 6);
+    out.print(F(", total, "));     out.println(chargeTotal_mAh, 6);
+    out.print(F("Energy_Wh, "));   out.print(energyWattHours(energy), 6);
+    out.print(F(", total, "));     out.println(energyTotal_Wh, 6);
+    }
+}
+
+// measures the time a measurement cycle needs besides the conversion on this hardware:
+// the I2C traffic of sensorAcquire() and writing a record to a scratch file, which is written
+// the same way as the logfiles. SD card writes are mostly buffered; every few records a
+// sector is written, which takes much longer. We budget for the 90th percentile, so most
+// cycles meet the delaytime; the sector writes go into the slack chooseSettings() leaves for
+// writeBack (mode 0), or are absorbed by the sample buffer (modes 1 and 2).
+unsigned long calibrateOverhead() {
+  // with the shortest conversion sensorAcquire() is almost all I2C
+  sensorConfigure(AVERAGE_1, CONV_TIME_140, CONV_TIME_140);
+  unsigned long i2cMicros=0;
+  unsigned long writeMicros[CALIBRATION_SAMPLES];
+
+  storageRemove(CALIBRATIONfilename);
+  encoderBegin(millis(), micros(), channelCount);
+  File scratch;
+  Print *out=NULL;
+  if (preallocMB>0) {
+    out=storageOpenContiguous(CALIBRATIONfilename, 65536UL);
+    }
+  if (!out) {
+    scratch=storageOpen(CALIBRATIONfilename, FILE_WRITE);
+    if (scratch) {
+      out=&scratch;
+      }
+    }
+
+  for (byte i=0; i<CALIBRATION_SAMPLES; i++) {
+    Sample s;
+    unsigned long start=micros();
+    sensorAcquire(s);
+    i2cMicros=max(i2cMicros, micros()-start);
+    start=micros();
+    scaleSample(s);
+    if (out) {
+      writeRecord(*out, s);
+      }
+    writeMicros[i]=micros()-start;
+    }
+
+  if (out==&scratch) {
+    scratch.close();
+    }
+  else if (out) {
+    storageCloseContiguous();
+    }
+  storageRemove(CALIBRATIONfilename);
+
+  // insertion sort, to find the 90th percentile
+  for (byte i=1; i<CALIBRATION_SAMPLES; i++) {
+    unsigned long v=writeMicros[i];
+    byte j=i;
+    for (; j>0 && writeMicros[j-1]>v; j--) {
+      writeMicros[j]=writeMicros[j-1];
+      }
+    writeMicros[j]=v;
+    }
+  unsigned long writeP90=writeMicros[CALIBRATION_SAMPLES*9/10];
+  i2cMicros-=min(i2cMicros, conversionPeriodMicros(AVERAGE_1, CONV_TIME_140, CONV_TIME_140));
+
+  Serial.print(F("  I2C: "));
+  Serial.print(i2cMicros);
+  Serial.print(F(" us, SD write p90: "));
+  Serial.print(writeP90);
+  Serial.print(F(" us, max: "));
+  Serial.print(writeMicros[CALIBRATION_SAMPLES-1]);
+  Serial.print(F(" us"));
+
+  // the interrupt of modes 1 and 2 reads the INA226 while loop() writes, only
+  // the I2C traffic takes time from the conversion
+  unsigned long overhead=i2cMicros;
+  if (acquisitionMode==0 && !aggregation) {
+    overhead+=writeP90;
+    }
+  return overhead;
+}
+
+// the overhead budgeted for a measured overhead: plus scaling, state machine and the timer/loop jitter
+unsigned long overheadBudget(unsigned long measured) {
+  return measured+measured/8+200;
+}
+
+// the slack writeBack needs in acquisition mode 0, if it is at most half of delaytime; otherwise
+// its SD card work is done within the cycles, at the expense of a late sample
+unsigned long sdReserve() {
+  unsigned long reserve=writeBack.reserveMicros(preallocMB==0);
+  return acquisitionMode==0 && !aggregation && reserve<=delaytime/2 ? reserve : 0;
+}
+
+// true if the measured value differs from the budgeted one by more than 1/OVERHEAD_DRIFT_RATIO
+bool drifted(unsigned long measured, unsigned long budget) {
+  return measured>budget+budget/OVERHEAD_DRIFT_RATIO || measured<budget-budget/OVERHEAD_DRIFT_RATIO;
+}
+
+// picks the best AVG and CTs which fit into delaytime besides overheadMicros (and the slack
+// for the SD card, see sdReserve()) and applies them; with aggregation the fastest settings
+// instead, delaytime becomes the resulting sample period
+void chooseSettings() {
+  if (aggregation) {
+    // in mode 2 the INA226 converts while the previous result is read, so a conversion has to
+    // take at least as long as the read; the periods the table allows grow by less than a factor
+    // of 2 from one to the next. Otherwise the shortest conversion.
+    long threshold=acquisitionMode==2 ? 2*(long)overheadMicros : 0;
+    findEnumsMaxProductBelowThreshold(threshold, shuntWeight, &avgResult, &ctShuntResult, &ctBusResult);
+    delaytime=conversionPeriodMicros(avgResult, ctShuntResult, ctBusResult);
+    if (acquisitionMode!=2) {
+      delaytime+=overheadMicros;
+      }
+    MaxCycles=max(1,trunc(SwitchTime*1000000.0/delaytime));
+    }
+  else {
+    sdReserveMicros=sdReserve();
+    findEnumsMaxProductBelowThreshold((long)delaytime-(long)overheadMicros-(long)sdReserveMicros, shuntWeight,
+                                      &avgResult, &ctShuntResult, &ctBusResult);
+    }
+  // without slack for it, holding back the SD card work only moves it to a later cycle
+  writeBack.setHolding(acquisitionMode!=0 || sdReserveMicros>0);
+  sensorConfigure(avgResult, ctShuntResult, ctBusResult);
+}
+
+void saveRate(RateSettings &r) {
+  r.delaytime=delaytime;
+  r.avg=avgResult;
+  r.ctShunt=ctShuntResult;
+  r.ctBus=ctBusResult;
+}
+
+// chooseSettings() for the burst frequency, if any, and then for the configured frequency, whose
+// settings stay applied; delaytime must be that of the configured frequency
+void chooseRates() {
+  unsigned long base=delaytime;
+  if (burstFreq>0) {
+    delaytime=1000000/burstFreq;
+    chooseSettings();
+    saveRate(burstRate);
+    delaytime=base;
+    }
+  chooseSettings();
+  saveRate(baseRate);
+}
+
+// a count of samples of the state machine, carried over to the new MaxCycles; MaxCycles+1 means
+// the transition is done
+int rescaleCycles(int cycles, int oldMaxCycles) {
+  return cycles>oldMaxCycles ? MaxCycles+1 : (long)cycles*MaxCycles/oldMaxCycles;
+}
+
+// switches between the configured and the burst frequency, see burst.h; SwitchTime stays the same
+// in seconds. The sampler of acquisition mode 1 must be stopped.
+void switchRate(bool burst) {
+  const RateSettings &r = burst ? burstRate : baseRate;
+  delaytime=r.delaytime;
+  avgResult=r.avg;
+  ctShuntResult=r.ctShunt;
+  ctBusResult=r.ctBus;
+  sensorConfigure(avgResult, ctShuntResult, ctBusResult);
+  int oldMaxCycles=MaxCycles;
+  MaxCycles=max(1,trunc(SwitchTime*1000000.0/delaytime));
+  CyclesCondMet=rescaleCycles(CyclesCondMet, oldMaxCycles);
+  CyclesCondNotMet=rescaleCycles(CyclesCondNotMet, oldMaxCycles);
+  bursting=burst;
+  RateChanged=logging;
+  if (burst) {
+    burstCount++;
+    }
+}
+
+// ends a line of the INI file which has n characters with spaces up to INI_LINE_CHARS
+void endIniLine(File &INIFile, size_t n) {
+  while (n++<INI_LINE_CHARS) {
+    INIFile.write(' ');
+    }
+  INIFile.println();
+}
+
+// writes the settings, iter and the charge and energy totals to the INI file; the lines are
+// padded to a fixed size, so once the file has that size, it is overwritten in place
+void writeIniFile() {
+  File INIFile = storageOpenUpdate(INIfilename);
+  if (!INIFile || INIFile.size()!=INI_FILE_SIZE) {
+    // missing, or written by hand or by an earlier version
+    INIFile.close();
+    storageRemove(INIfilename);
+    INIFile = storageOpen(INIfilename, FILE_WRITE);
+    }
+  if (INIFile){
+    float chargeTotal_mAh=chargeBase_mAh+chargeMilliAmpHours(chargeRaw);
+    float energyTotal_Wh=energyBase_Wh+energyWattHours(energyRaw);
+    if (!serialStream) {
+      Serial.print(F("Writing inifile "));
+      Serial.print(INIfilename);
+      Serial.print(F(" with iter="));
+      Serial.print(iter);
+      Serial.print(F(", freq="));
+      Serial.print(freq, 10);
+      Serial.print(F(", busVoltageThreshold="));
+      Serial.print(busVoltageThreshold, 10);
+      Serial.print(F(", currentThreshold="));
+      Serial.print(currentThreshold, 10);
+      Serial.print(F(", logFormat="));
+      Serial.print(logFormat);
+      Serial.print(F(", acquisitionMode="));
+      Serial.print(acquisitionMode);
+      Serial.print(F(", preallocMB="));
+      Serial.print(preallocMB);
+      Serial.print(F(", catchUpPolicy="));
+      Serial.print(catchUpPolicy);
+      Serial.print(F(", shuntWeight="));
+      Serial.print(shuntWeight);
+      Serial.print(F(", aggregation="));
+      Serial.print(aggregation);
+      Serial.print(F(", total mAh="));
+      Serial.print(chargeTotal_mAh, 6);
+      Serial.print(F(", total Wh="));
+      Serial.print(energyTotal_Wh, 6);
+      Serial.print(F(", channels="));
+      Serial.print(channelCount);
+      Serial.print(F(", triggerPolicy="));
+      Serial.print(triggerPolicy);
+      Serial.print(F(", pretriggerSamples="));
+      Serial.print(pretriggerSamples);
+      Serial.print(F(", serialStream="));
+      Serial.print(serialStream);
+      Serial.print(F(", sdBenchmark="));
+      Serial.print(sdBenchmarkRun);
+      Serial.print(F(", lowPowerStandby="));
+      Serial.print(lowPowerStandby);
+      Serial.print(F(", burstFreq="));
+      Serial.print(burstFreq, 10);
+      Serial.print(F(", burstHoldMillis="));
+      Serial.print(burstHoldMillis);
+      Serial.print(F(", burstCurrentStep_mA="));
+      Serial.print(burstCurrentStep_mA, 10);
+      Serial.print(F(", burstVoltageStep_V="));
+      Serial.println(burstVoltageStep_V, 10);
+      }
+    endIniLine(INIFile, INIFile.print(iter));
+    endIniLine(INIFile, INIFile.print(freq,10));
+    endIniLine(INIFile, INIFile.print(busVoltageThreshold,10));
+    endIniLine(INIFile, INIFile.print(currentThreshold,10));
+    endIniLine(INIFile, INIFile.print(logFormat));
+    endIniLine(INIFile, INIFile.print(acquisitionMode));
+    endIniLine(INIFile, INIFile.print(preallocMB));
+    endIniLine(INIFile, INIFile.print(catchUpPolicy));
+    endIniLine(INIFile, INIFile.print(shuntWeight));
+    endIniLine(INIFile, INIFile.print(aggregation));
+    endIniLine(INIFile, INIFile.print(chargeTotal_mAh,6));
+    endIniLine(INIFile, INIFile.print(energyTotal_Wh,6));
+    size_t n=0;
+    for (byte ch=0; ch<channelCount; ch++) {
+      if (ch>0) {
+        n+=INIFile.print(",");
+        }
+      n+=INIFile.print(F("0x"));
+      n+=INIFile.print(channelAddresses[ch], HEX);
+      }
+    endIniLine(INIFile, n);
+    endIniLine(INIFile, INIFile.print(triggerPolicy));
+    endIniLine(INIFile, INIFile.print(pretriggerSamples));
+    endIniLine(INIFile, INIFile.print(serialStream));
+    endIniLine(INIFile, INIFile.print(sdBenchmarkRun));
+    endIniLine(INIFile, INIFile.print(lowPowerStandby));
+    endIniLine(INIFile, INIFile.print(burstFreq,10));
+    endIniLine(INIFile, INIFile.print(burstHoldMillis));
+    endIniLine(INIFile, INIFile.print(burstCurrentStep_mA,10));
+    endIniLine(INIFile, INIFile.print(burstVoltageStep_V,10));
+    INIFile.close();
+    }
+  else{
+    if (!serialStream) {
+      Serial.println(F("issue writing inifile to SD Card"));
+      }
+    delay(10000);
+    reboot();
+  }
+}
+
+// the name of the logfile with the given number
+void logfileName(char *name, size_t size, int number) {
+  snprintf(name, size, logFormat ? "log%05d.bin" : "log%05d.csv", number);
+}
+
+// opens the logfile of iter for writeBack; a pre-allocated, contiguous file avoids the FAT
+// updates while logging; if the card has no contiguous space of that size left, we fall back
+// to a growing file
+bool openLogfile() {
+  char logfn[20];
+  logfileName(logfn, sizeof(logfn), iter);
+  Print *contiguousFile = NULL;
+  if (preallocMB>0) {
+    contiguousFile=storageOpenContiguous(logfn, preallocMB*1048576UL);
+    }
+  if (contiguousFile) {
+    writeBack.begin(contiguousFile, NULL);
+    contiguous=true;
+    return true;
+    }
+  logfile=storageOpen(logfn,FILE_WRITE);
+  writeBack.begin(&logfile, &logfile);
+  contiguous=false;
+  return logfile;
+}
+
+// opens the logfile of the next measurement cycle ahead of time and writes the INI file with its
+// number, so the transition to logging neither creates nor allocates a file; called when
+// standby starts. The file stays empty until the cycle starts.
+void stageLogfile() {
+  logfileStaged=openLogfile();
+  writeIniFile();
+}
+
+// removes the logfile with the given number if it was staged but never written, i.e. it is empty
+// or, if pre-allocated, does not start with a header; true if it did so
+bool removeUnusedLogfile(int number) {
+  char logfn[20];
+  logfileName(logfn, sizeof(logfn), number);
+  if (!storageExists(logfn)) {
+    return false;
+    }
+  File f = storageOpen(logfn, FILE_READ);
+  const char *header = logFormat ? LOG_MAGIC : "Data measured from";
+  bool unused = false;
+  for (byte i=0; header[i]; i++) {
+    if (!f.available() || f.read()!=header[i]) {
+      unused = true;
+      break;
+      }
+    }
+  f.close();
+  return unused && storageRemove(logfn);
+}
+
+// starts the measurements of the acquisition mode; at power-up and after the low-power standby
+void startAcquisition() {
+  if (acquisitionMode==2) {
+    sensorStartContinuous();
+    samplerStartContinuous(channelAddresses, channelCount, alertPin);
+    }
+  else {
+    sensorStartTriggered();
+    if (acquisitionMode==1) {
+      samplerStart(channelAddresses, channelCount, delaytime);
+      }
+    }
+}
+
+// the INA226 alert which wakes the logger from the low-power standby: with both thresholds the
+// power over-limit, as both are met only above their product, with the bus voltage threshold
+// alone the bus voltage over-limit; the power and bus voltage registers hold magnitudes, like the
+// abs() of the threshold check. Rounded so the alert trips rather early than late. False
+// otherwise: the shunt voltage limits compare one current direction only, and without
+// thresholds the logger logs all the time.
+bool standbyAlertLimit(uint16_t &function, uint16_t &limit) {
+  if (busVoltageThreshold>0 && currentThreshold>0) {
+    function=ALERT_POWER_OVER;
+    limit=min(busVoltageThreshold*currentThreshold/(25.0*currentLSB_mA), 65535.0);
+    }
+  else if (busVoltageThreshold>0) {
+    function=ALERT_BUS_OVER;
+    limit=min(busVoltageThreshold/0.00125, 65535.0);
+    }
+  else {
+    return false;
+    }
+  return true;
+}
+
+// RAM budget: static data, heap, the deepest stack so far and the free bytes between heap and stack
+void writeRamUsage(Print &out, const RamUsage &ram) {
+  out.print(F("RAM_bytes,"));               out.println(ram.total);
+  out.print(F("static_bytes,"));            out.println(ram.staticBytes);
+  out.print(F("heap_bytes,"));              out.println(ram.heapBytes);
+  out.print(F("stack_bytes,"));             out.println(ram.stackBytes);
+  out.print(F("RAM headroom_bytes,"));      out.println(ram.headroomBytes);
+}
 
 void setup() {
+  ramPaint();
   
-  Serial.begin(460800);
+  Serial.begin(STREAM_BAUD);
   while (!Serial);
   Serial.println();Serial.println();
 
   Serial.print(F("Initializing DS1307 ..."));
   rtcsetup(__DATE__,__TIME__);
+  timebaseBegin(sqwPin);
+  if (timebaseLocked()) {
+    Serial.println(F("time base follows the RTC square wave"));
+    }
+  else {
+    Serial.println(F("no RTC square wave on D3, the time base runs on micros()"));
+    }
 
   Serial.print(F("Initializing SD card..."));
-  if (!SD.begin(chipSelect)) {
+  if (!storageBegin(chipSelect)) {
     Serial.println(F("failed"));
     delay(10000);
     reboot();
@@ -171,11 +883,12 @@ void setup() {
   // INI File Handling : read current values, ensure integrity, check file available
   File INIFile;
 
-  if (SD.exists(INIfilename)){
-    INIFile = SD.open(INIfilename, FILE_READ);
+  if (storageExists(INIfilename)){
+    INIFile = storageOpen(INIfilename, FILE_READ);
 
-    if (INIFile.size()<=500) {
-      char buffer[16];
+    if (INIFile.size()<=2*INI_FILE_SIZE) {
+      // the longest line is the address list, e.g. "0x40,0x41,0x44"
+      char buffer[24];
       // reading the last logfile generation number used
 
       FileReadLn(INIFile, buffer, sizeof(buffer));
@@ -197,6 +910,103 @@ void setup() {
       if (atof(buffer)>0.0) {
         currentThreshold=atof(buffer);
       }
+      // the log format, 0 = CSV, 1 = binary, 2 = delta encoded binary
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        logFormat=atoi(buffer)==2 ? 2 : 1;
+      }
+      // the acquisition mode, 0 = loop(), 1 = timer interrupt, 2 = ALERT interrupt
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0 && atoi(buffer)<=2) {
+        acquisitionMode=atoi(buffer);
+      }
+      // the size of pre-allocated logfiles in MB
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        preallocMB=atoi(buffer);
+      }
+      // the catch-up policy after an overrun, 0 = skip, 1 = burst
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        catchUpPolicy=1;
+      }
+      // the weight of the shunt conversion time, 0 = same CT for bus and shunt
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        shuntWeight=min(atoi(buffer), 255);
+      }
+      // aggregation, 0 = off, 1 = one row per logging interval
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        aggregation=1;
+      }
+      // the charge and energy totals of the earlier power-ups, may be negative
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      chargeBase_mAh=atof(buffer);
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      energyBase_Wh=atof(buffer);
+      // the I2C addresses of the INA226 devices, comma separated, e.g. "0x40,0x41"
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      char *next=buffer;
+      byte channels=0;
+      while (channels<MAX_CHANNELS) {
+        char *end;
+        long address=strtol(next, &end, 0);
+        if (end==next || address<=0 || address>0x7F) {
+          break;
+          }
+        channelAddresses[channels++]=address;
+        next=end;
+        while (*next==',' || *next==' ') {
+          next++;
+          }
+        }
+      if (channels>0) {
+        channelCount=channels;
+      }
+      // the trigger policy with several channels, 0 = any channel, 1 = all channels
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        triggerPolicy=1;
+      }
+      // the number of pre-trigger samples, 0 = off
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atol(buffer)>0) {
+        pretriggerSamples=min(atol(buffer), 65535L);
+      }
+      // the serial output, 0 = text, 1 = binary stream of every sample
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        serialStream=1;
+      }
+      // 1 = benchmark the SD card at this power-up
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        sdBenchmarkRun=1;
+      }
+      // the standby, 0 = measuring at freq, 1 = sleeping until the INA226 alert
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atoi(buffer)>0) {
+        lowPowerStandby=1;
+      }
+      // the adaptive sampling rate: burst frequency (0 = off), hold time in ms, current step
+      // in mA and bus voltage step in V
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atof(buffer)>0.0) {
+        burstFreq=atof(buffer);
+      }
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atol(buffer)>0) {
+        burstHoldMillis=atol(buffer);
+      }
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atof(buffer)>0.0) {
+        burstCurrentStep_mA=atof(buffer);
+      }
+      FileReadLn(INIFile,buffer,sizeof(buffer));
+      if (atof(buffer)>0.0) {
+        burstVoltageStep_V=atof(buffer);
+      }
 
       INIFile.close();
       Serial.print(F("Read "));
@@ -208,7 +1018,43 @@ void setup() {
       Serial.print(F(", voltage threshold="));
       Serial.print(busVoltageThreshold, 10);
       Serial.print(F(", current threshold="));
-      Serial.println(currentThreshold, 10);
+      Serial.print(currentThreshold, 10);
+      Serial.print(F(", log format="));
+      Serial.print(logFormat);
+      Serial.print(F(", acquisition mode="));
+      Serial.print(acquisitionMode);
+      Serial.print(F(", pre-allocated MB="));
+      Serial.print(preallocMB);
+      Serial.print(F(", catch-up policy="));
+      Serial.print(catchUpPolicy);
+      Serial.print(F(", shunt weight="));
+      Serial.print(shuntWeight);
+      Serial.print(F(", aggregation="));
+      Serial.print(aggregation);
+      Serial.print(F(", total mAh="));
+      Serial.print(chargeBase_mAh, 6);
+      Serial.print(F(", total Wh="));
+      Serial.print(energyBase_Wh, 6);
+      Serial.print(F(", channels="));
+      Serial.print(channelCount);
+      Serial.print(F(", trigger policy="));
+      Serial.print(triggerPolicy);
+      Serial.print(F(", pre-trigger samples="));
+      Serial.print(pretriggerSamples);
+      Serial.print(F(", serial stream="));
+      Serial.print(serialStream);
+      Serial.print(F(", SD card benchmark="));
+      Serial.print(sdBenchmarkRun);
+      Serial.print(F(", low-power standby="));
+      Serial.print(lowPowerStandby);
+      Serial.print(F(", burst frequency="));
+      Serial.print(burstFreq, 10);
+      Serial.print(F(", burst hold ms="));
+      Serial.print(burstHoldMillis);
+      Serial.print(F(", burst current step mA="));
+      Serial.print(burstCurrentStep_mA, 10);
+      Serial.print(F(", burst voltage step V="));
+      Serial.println(burstVoltageStep_V, 10);
 
       iter++;
       }
@@ -233,69 +1079,284 @@ void setup() {
   // currentThreshold=0.0;
   // end of TEMP section
   
+  if (preallocMB>0 && !storageBeginContiguous(chipSelect)) {
+    Serial.println(F("raw SD card access failed, logfiles will not be pre-allocated"));
+    preallocMB=0;
+    }
+
+  // the rows of aggregated logfiles are few, they are always written as CSV
+  if (aggregation && logFormat) {
+    Serial.println(F("aggregated logfiles are written as CSV"));
+    logFormat=0;
+    }
+
+  // the logfile staged before the last power-down is reused if it was never written
+  if (iter>1 && removeUnusedLogfile(iter-1)) {
+    iter--;
+    }
+
   // initialize global values
   delaytime= 1000000/freq;
+  logInterval=delaytime;
   MaxCycles=max(1,trunc(SwitchTime*freq));
   Serial.print(F("delaytime: "));
   Serial.print(delaytime);
   Serial.println(F(" microseconds"));
 
+  // the pre-trigger buffer takes the slots of the sample buffer the acquisition mode does not use
+  byte sampleSlots=0;
+  if (acquisitionMode) {
+    sampleSlots=pretriggerSamples>0 ? SAMPLE_BUFFER_SIZE/2 : SAMPLE_BUFFER_SIZE;
+    sampleBuffer.setSlots(sampleSlots);
+    }
+  pretriggerBegin(channelCount, pretriggerSamples, sampleBuffer.memory()+sampleSlots*sizeof(Sample),
+                  (SAMPLE_BUFFER_SIZE-sampleSlots)*sizeof(Sample));
+  if (pretriggerCapacity()<pretriggerSamples) {
+    Serial.print(F("the pre-trigger buffer holds "));
+    Serial.print(pretriggerCapacity());
+    Serial.println(F(" samples"));
+    pretriggerSamples=pretriggerCapacity();
+    }
+
+  // the low-power standby takes no samples, and only the first device has its ALERT pin connected
+  if (lowPowerStandby && (pretriggerSamples>0 || (channelCount>1 && triggerPolicy==0))) {
+    Serial.println(F("low-power standby needs 0 pre-trigger samples and, with several devices, trigger policy 1"));
+    lowPowerStandby=0;
+    }
+  uint16_t alertFunction, alertLimit;
+  if (lowPowerStandby && !standbyAlertLimit(alertFunction, alertLimit)) {
+    Serial.println(F("low-power standby needs a bus voltage threshold, the INA226 alert sees one current direction only"));
+    lowPowerStandby=0;
+    }
+
+  // the burst frequency needs the timer paced acquisition of the samples
+  if (burstFreq>0 && (aggregation || acquisitionMode==2 || burstFreq<=freq)) {
+    Serial.println(F("the burst frequency needs acquisition mode 0 or 1, no aggregation and to be above the frequency"));
+    burstFreq=0;
+    }
+  burstBegin(min(burstCurrentStep_mA/currentLSB_mA, 65535.0), min(burstVoltageStep_V/0.00125, 65535.0),
+             burstHoldMillis*1000, channelCount);
+
+  // once; the INI file is rewritten with the line reset below, see stageLogfile()
+  if (sdBenchmarkRun) {
+    sdBenchmark(chipSelect, channelCount, currentLSB_mA);
+    sdBenchmarkRun=0;
+    }
+
   Serial.print(F("Initializing INA226 ..."));
-  Wire.begin();
-  ina226.init();
-  // the "red" module/shield uses a 0.002 Ohm shunt and supports measurements up to 20A
-  ina226.setResistorRange(0.002, 20.0);
-  // correction factor for my "red" module/shield 
-  ina226.setCorrectionFactor(0.947818013);
-  ina226.readAndClearFlags();
-  ina226.waitUntilConversionCompleted();
-
-  // find the longest product of AVG and CT which is below delaytime
-  averageMode avgResult;
-  convTime ctResult;
-  // The value 7500 is specific for my hardware!
-  // During a measurement cycle the INA226 measurements and the SD write operation take most of the time.
-  // My hardware needs around 7500 OR 14000 microseconds to write to the SD library. My understanding is that the lower value
-  // is when the SD library buffers the data and the higher value is when the SD library actually writes to the SD card.
-  // So, using 7500 microseconds here means that every few measurements - when actual SD card writes happen - the delaytime can not be met.
-  findEnumsMaxProductBelowThreshold(delaytime-7500, &avgResult, &ctResult);
-  ina226.setAverage(avgResult);
-  ina226.setConversionTime(ctResult);
+  sensorBegin(channelAddresses, channelCount, shuntResistor, currentRange, correctionFactor);
+  csvRowBegin(currentLSB_mA, channelCount);
+
+  // find the longest product of AVG and CT which is below delaytime minus the time the rest of
+  // the measurement cycle takes on this SD card, see calibrateOverhead()
+  overheadP90=calibrateOverhead();
+  overheadMicros=overheadBudget(overheadP90);
+  chooseRates();
+  Serial.print(F("  overhead: "));
+  Serial.print(overheadMicros);
+  Serial.print(F(" us  SD reserve: "));
+  Serial.print(sdReserveMicros);
+  Serial.print(F(" us"));
+  if (aggregation) {
+    Serial.print(F("  aggregating, sample period: "));
+    Serial.print(delaytime);
+    Serial.print(F(" us"));
+    }
   Serial.print("  AVG (HEX): 0x");
   Serial.print(avgResult, HEX);
-  Serial.print("  CT (HEX): 0x");
-  Serial.print(ctResult, HEX);
-  ina226.setMeasureMode(TRIGGERED);
+  Serial.print("  CT shunt (HEX): 0x");
+  Serial.print(ctShuntResult, HEX);
+  Serial.print("  CT bus (HEX): 0x");
+  Serial.print(ctBusResult, HEX);
+  if (acquisitionMode==2) {
+    // the INA226 paces the measurements, a sample is ready every AVG x (bus CT + shunt CT);
+    // findEnumsMaxProductBelowThreshold() only guarantees that this is below delaytime,
+    // so we continue with the real period
+    delaytime=conversionPeriodMicros(avgResult, ctShuntResult, ctBusResult);
+    MaxCycles=max(1,trunc(SwitchTime*1000000.0/delaytime));
+    Serial.print(F("  sample period: "));
+    Serial.print(delaytime);
+    Serial.print(F(" microseconds"));
+    }
+  startAcquisition();
   Serial.println(F(" - ok"));   
+  stageLogfile();
+  // the setup above used most of what the logger does, e.g. the SD card, the INI file and a logfile
+  RamUsage ram;
+  ramUsage(ram);
+  writeRamUsage(Serial, ram);
+  if (ram.stackBytes>0 && ram.headroomBytes<MIN_RAM_HEADROOM) {
+    Serial.print(F("less than "));
+    Serial.print(MIN_RAM_HEADROOM);
+    Serial.println(F(" bytes of RAM left between heap and stack"));
+    }
   Serial.println(F("\nStarting Measurements..."));
+  if (serialStream) {
+    streamBegin(currentRange, delaytime, channelAddresses, channelCount);
+    }
+  // t0 of the measurement grid of acquisition mode 0
+  NextDeadline=micros();
 }
 
-void loop() {
-  StartOfLoopMicros=micros();
+// run summary of the current logfile: settings, late or lost samples and the timing of the
+// phases of the measurement cycle, see looptiming.h
+void writeSummary(Print &out) {
+  out.print(F("logfile generation,"));      out.println(iter);
+  out.print(F("delaytime_us,"));            out.println(delaytime);
+  out.print(F("log interval_us,"));         out.println(logInterval);
+  out.print(F("acquisition mode,"));        out.println(acquisitionMode);
+  out.print(F("channels,"));                out.println(channelCount);
+  out.print(F("pre-trigger samples,"));     out.println(pretriggerWritten);
+  out.print(F("AVG,0x"));                   out.println(avgResult, HEX);
+  out.print(F("CT shunt,0x"));              out.println(ctShuntResult, HEX);
+  out.print(F("CT bus,0x"));                out.println(ctBusResult, HEX);
+  out.print(F("overhead_us,"));             out.println(overheadMicros);
+  out.print(F("SD reserve_us,"));           out.println(sdReserveMicros);
+  out.print(F("bursts,"));                  out.println(burstCount);
+  out.print(F("burst period_us,"));         out.println(burstFreq>0 ? burstRate.delaytime : 0);
+  out.print(F("overruns,"));                out.println(overruns);
+  out.print(F("missed slots,"));            out.println(missedSlots);
+  out.print(F("sample buffer overflows,")); out.println(samplerOverflows());
+  out.print(F("late conversions,"));        out.println(samplerLateTicks());
+  out.print(F("stream drops,"));            out.println(streamDrops());
+  out.print(F("SD writes without slack,")); out.println(writeBack.forcedCount());
+  out.print(F("RTC square wave,"));         out.println(timebaseLocked());
+  out.print(F("RTC second_us,"));           out.println(timebaseSecondMicros());
+  out.print(F("charge_mAh,"));              out.println(chargeMilliAmpHours(chargeRaw-chargeAtOpen), 6);
+  out.print(F("energy_Wh,"));               out.println(energyWattHours(energyRaw-energyAtOpen), 6);
+  out.print(F("total charge_mAh,"));        out.println(chargeBase_mAh+chargeMilliAmpHours(chargeRaw), 6);
+  out.print(F("total energy_Wh,"));         out.println(energyBase_Wh+energyWattHours(energyRaw), 6);
+  RamUsage ram;
+  ramUsage(ram);
+  writeRamUsage(out, ram);
+  timingReport(out);
+}
 
-  // Trigger measurement and fetch results
-    ina226.startSingleMeasurement();
-    ina226.readAndClearFlags();
+// adds seconds to a date and time, with the carries into minutes, hours, days, months and years
+void addSeconds(DateTime &t, unsigned long seconds) {
+  static const uint8_t DAYS_PER_MONTH[12] PROGMEM = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  seconds+=t.second;
+  t.second=seconds%60;
+  unsigned long minutes=t.minute+seconds/60;
+  t.minute=minutes%60;
+  unsigned long hours=t.hour+minutes/60;
+  t.hour=hours%24;
+  for (unsigned long days=hours/24; days>0; days--) {
+    // 2000..2099, the range of the DS1307
+    byte monthDays=pgm_read_byte_near(DAYS_PER_MONTH+t.month-1)+(t.month==2 && t.year%4==0);
+    if (++t.day>monthDays) {
+      t.day=1;
+      if (++t.month>12) {
+        t.month=1;
+        t.year++;
+        }
+      }
+    }
+}
 
-    // Bus Voltage is measured between GND and V+ (of the module, VBUS of the INA226 chip)
-    // Shunt Voltage is measured between Current- and Current+
-    busVoltage_V = ina226.getBusVoltage_V();
-    current_mA = -ina226.getCurrent_mA();
-    shuntVoltage_mV = ina226.getShuntVoltage_mV();
-    power_mW = ina226.getBusPower();
+// seconds since 01/01/2000 00:00:00 of a date and time, 2000..2099
+unsigned long daySeconds(const DateTime &t) {
+  static const uint16_t DAYS_BEFORE_MONTH[12] PROGMEM = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  uint16_t years=t.year-2000;
+  unsigned long days=365UL*years+(years+3)/4+pgm_read_word_near(DAYS_BEFORE_MONTH+t.month-1)+t.day-1;
+  if (t.month>2 && t.year%4==0) {
+    days++;
+    }
+  return ((days*24+t.hour)*60+t.minute)*60+t.second;
+}
 
-    // "loadVoltage" is the Bus Voltage minus the Shunt Voltage
-    loadVoltage_V  = busVoltage_V - (shuntVoltage_mV/1000);
+// seconds from one date and time to a later one, 2000..2099
+unsigned long secondsBetween(const DateTime &from, const DateTime &to) {
+  return daySeconds(to)-daySeconds(from);
+}
 
-    if(!ina226.overflow){
-        strcpy(status,"ok");  
-        }
-    else{
-      strcpy(status,"overflow");  
+// reads the RTC into clockTime
+void readClock() {
+  unsigned long start=micros();
+  // the sampler interrupt must stay off the I2C bus while we talk to the RTC
+  samplerSuspend();
+  clockValid=rtcGetDateTime(clockTime, !serialStream);
+  samplerResume();
+  clockMillis=millis();
+  rtcMicros=micros()-start;
+}
+
+// reads the RTC in standby, once a second and only if the slack allows, so the transition to
+// logging does not have to; see clockNow()
+void refreshClock(unsigned long slackMicros) {
+  if ((!clockValid || millis()-clockMillis>=1000) && slackMicros>=rtcMicros) {
+    readClock();
+    }
+}
+
+// the current date and time: the RTC time read in standby plus the seconds since, or if that is
+// older than a few seconds, read from the RTC now. False if the RTC could not be read.
+bool clockNow(DateTime &now) {
+  const unsigned long MAX_AGE_MILLIS=5000;
+  if (!clockValid || millis()-clockMillis>MAX_AGE_MILLIS) {
+    readClock();
+    }
+  now=clockTime;
+  addSeconds(now, (millis()-clockMillis)/1000);
+  return clockValid;
+}
+
+// low-power standby: instead of measuring at freq to find out that nothing is to be logged, the
+// MCU sleeps while the INA226 compares its conversions with the alert limit. After the alert the
+// measurements resume, and the thresholds are checked over MaxCycles samples as usual; if they
+// are not met, the logger goes back to sleep after MaxCycles samples.
+void standbySleep() {
+  uint16_t function, limit;
+  if (!standbyAlertLimit(function, limit)) {
+    return;
+    }
+  if (acquisitionMode) {
+    samplerStop();
+    }
+  readClock();
+  DateTime asleep=clockTime;
+  sensorSleepUntilAlert(function, limit, alertPin);
+  // millis() and micros() stood still, the RTC tells how long we slept
+  readClock();
+  DateTime epoch;
+  if (clockValid && timebaseEpoch(epoch)) {
+    timebaseResume(secondsBetween(epoch, clockTime));
+    }
+  startAcquisition();
+  if (!serialStream) {
+    Serial.print(F("\nwoken by the INA226 alert after "));
+    Serial.print(secondsBetween(asleep, clockTime));
+    Serial.println(F(" s of low-power standby"));
+    }
+  // the charge and energy of the time asleep are unknown, and the grid of acquisition mode 0
+  // starts again
+  integrating=false;
+  CyclesCondNotMet=0;
+  NextDeadline=micros();
+}
+
+// uses the time until the next sample: while logging for the SD card work writeBack held back,
+// in standby to read the RTC for the start time of the next logfile, unless the time base
+// follows the RTC square wave
+void serviceIdle(unsigned long slackMicros) {
+  unsigned long start=micros();
+  if (logging) {
+    if (writeBack.service(slackMicros)) {
+      timingRecord(PHASE_FLUSH, micros()-start);
       }
-  
+    }
+  else if (!timebaseLocked()) {
+    refreshClock(slackMicros);
+    }
+}
+
+// runs the logging state machine for one sample and writes it to the logfile
+void processSample(const Sample &s) {
+    bool conditionMet = thresholdsMet(s);
+    integrateSample(s);
+
   // determine when to start/ stop logging; manage transitions
-    if ((abs(busVoltage_V)>=busVoltageThreshold && (abs(current_mA))>=currentThreshold) || (ina226.overflow)) {
+    if (conditionMet) {
       // condition met, so CyclesCondMet is increased up to a maximum of MaxCycles+1
       if (CyclesCondMet<MaxCycles+1) {
         CyclesCondMet++;
@@ -318,163 +1379,466 @@ void loop() {
       logging=true;
       CyclesCondMet=MaxCycles+1;
 
-      // handle invalid RTC info
-      if (!Rtc.IsDateTimeValid()) 
-      {
-          if (!wasError("IsDateTimeValid in loop()"))
-          {
-              // Common Causes:
-              //    1) the battery on the device is low or even missing and the power line was disconnected
-              Serial.println(F("Lost confidence in RTC DateTime!"));
+      // re-tune AVG and CT if the overhead or the SD card work measured while the previous
+      // logfiles were written differs from the budget; the settings stay fixed while the logfile
+      // is open
+      if (acquisitionMode==0 && (drifted(overheadBudget(overheadP90), overheadMicros) || drifted(sdReserve(), sdReserveMicros))) {
+        overheadMicros=overheadBudget(overheadP90);
+        chooseRates();
+        if (!serialStream) {
+          Serial.print(F("\nre-tuned for an overhead of "));
+          Serial.print(overheadMicros);
+          Serial.print(F(" us and an SD reserve of "));
+          Serial.print(sdReserveMicros);
+          Serial.print(F(" us: AVG (HEX): 0x"));
+          Serial.print(avgResult, HEX);
+          Serial.print(F("  CT shunt (HEX): 0x"));
+          Serial.print(ctShuntResult, HEX);
+          Serial.print(F("  CT bus (HEX): 0x"));
+          Serial.println(ctBusResult, HEX);
           }
-      }
+        }
+
+      // the logfile and the INI file were prepared in standby, see stageLogfile(); this is the
+      // fallback if that failed. The INI file with the updated iter, so logfile names remain
+      // unique, is written before the header: once a pre-allocated logfile has its first sector,
+      // the multi-block write occupies the card until it is closed, see contiguouslog.h
+      bool opened=logfileStaged;
+      if (!logfileStaged) {
+        opened=openLogfile();
+        writeIniFile();
+        }
+      logfileStaged=false;
+
+      // the logfile starts with the samples of the pre-trigger buffer, if any
+      Sample first=s;
+      pretriggerPeek(first, s.millis, s.micros);
+      logStartMillis=first.millis;
+      logStartMicros=first.micros;
+      timebaseAt(first.micros, logStart);
+
+      // with the RTC square wave the start time is the second of the time base the first record
+      // falls into, and the rows count from that second; otherwise the rows count from the
+      // first record, and its time is read from the RTC
+      bool rtcLocked=timebaseLocked();
+      DateTime now;
+      bool rtcValid;
+      if (rtcLocked) {
+        rtcValid=timebaseEpoch(now);
+        addSeconds(now, logStart.seconds);
+        logOrigin.seconds=logStart.seconds;
+        logOrigin.micros=0;
+        }
+      else {
+        rtcValid=clockNow(now);
+        logOrigin=logStart;
+        }
+      csvSetOrigin(logOrigin);
 
       // prep datestring for the logfile header
-      char datestring[21];
-      RtcDateTime now = Rtc.GetDateTime();
-      if (!wasError("GetDateTime in loop")) {
+      // sized as in printDateTime(), for the widest values of the fields
+      char datestring[26] = "";
+      if (rtcValid) {
 
         snprintf_P(datestring, 
-                countof(datestring),
+                sizeof(datestring),
                 PSTR("%02u/%02u/%04u %02u:%02u:%02u"),
-                now.Day(),
-                now.Month(),
-                now.Year(),
-                now.Hour(),
-                now.Minute(),
-                now.Second() );
+                now.day,
+                now.month,
+                now.year,
+                now.hour,
+                now.minute,
+                now.second );
       }
 
-      // open new logfile
       char logfn[20];
-      snprintf(logfn, sizeof(logfn), "log%05d.csv", iter);
-
-      logfile=SD.open(logfn,FILE_WRITE);
-      if (logfile){
-        Serial.print(F("\nWriting to "));
-        Serial.println(logfn);  
-        Serial.println(datestring);
-        logfile.print(F("Data measured from, "));
-        logfile.println(datestring);
-        logfile.println(F("millis,micros,status,Load_Voltage,Current_mA, load_Power_mW"));
-        // ensure at least the header is written to the SD card
-        logfile.flush();
+      logfileName(logfn, sizeof(logfn), iter);
+      if (opened){
+        // the first window starts with the first sample; sets the channels of the aggregated header
+        aggregateBegin(first.micros, channelCount);
+        if (!serialStream) {
+          Serial.print(F("\nWriting to "));
+          Serial.println(logfn);
+          Serial.println(datestring);
+          }
+        if (logFormat) {
+          LogHeader header;
+          memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+          header.version = LOG_FORMAT_VERSION;
+          header.headerSize = sizeof(LogHeader);
+          header.recordSize = logFormat==2 ? 0 : sizeof(LogRecord);
+          header.rtcValid = rtcValid;
+          header.shuntResistor = shuntResistor;
+          header.currentRange = currentRange;
+          header.correctionFactor = correctionFactor;
+          header.delaytime = delaytime;
+          header.averageMode = avgResult;
+          header.convTime = ctShuntResult;
+          header.year = now.year;
+          header.month = now.month;
+          header.day = now.day;
+          header.hour = now.hour;
+          header.minute = now.minute;
+          header.second = now.second;
+          header.encoding = logFormat==2 ? LOG_ENCODING_DELTA : LOG_ENCODING_FIXED;
+          header.startMillis = first.millis;
+          header.startMicros = first.micros;
+          header.firstSlot = SlotIndex;
+          header.overheadMicros = overheadMicros;
+          header.busConvTime = ctBusResult;
+          header.channels = channelCount;
+          memset(header.channelAddress, 0, sizeof(header.channelAddress));
+          memcpy(header.channelAddress, channelAddresses, channelCount);
+          header.pretriggerSamples = pretriggerCount();
+          header.timeSource = rtcLocked ? LOG_TIME_RTC : LOG_TIME_MICROS;
+          header.startOffsetMicros = logStart.micros-logOrigin.micros;
+          LastRecordMicros = header.startMicros;
+          encoderBegin(header.startMillis, header.startMicros, channelCount);
+          logout->write((const uint8_t*)&header, sizeof(header));
+          }
+        else {
+          logout->print(F("Data measured from, "));
+          logout->println(datestring);
+          if (aggregation) {
+            aggregateWriteHeader(*logout);
+            }
+          else if (channelCount==1) {
+            logout->println(F("millis,micros,status,Load_Voltage,Current_mA, load_Power_mW,time_s"));
+            }
+          else {
+            logout->print(F("millis,micros,status"));
+            for (byte ch=1; ch<=channelCount; ch++) {
+              logout->print(F(",Load_Voltage_"));   logout->print(ch);
+              logout->print(F(",Current_mA_"));     logout->print(ch);
+              logout->print(F(", load_Power_mW_")); logout->print(ch);
+              }
+            logout->println(F(",time_s"));
+            }
+          }
+        // writeBack writes the header to the SD card in the slack time, like the records
+        // the statistics cover this logfile only
+        overruns=0;
+        missedSlots=0;
+        GapSlots=0;
+        chargeAtOpen=chargeRaw;
+        energyAtOpen=energyRaw;
+        samplerResetCounters();
+        timingReset();
+        burstCount=0;
+        RateChanged=false;
+
+        // the pre-trigger samples, then the current one as usual. The charge and energy of the
+        // logfile count from its first row, so what its other rows added to chargeRaw and energyRaw
+        // in standby is taken off the snapshot.
+        pretriggerWritten=pretriggerCount();
+        Sample p;
+        unsigned long previousMicros=0;
+        for (unsigned int i=0; pretriggerPop(p, s.millis, s.micros); i++) {
+          if (i>0) {
+            chargeAtOpen-=sampleCharge(p, p.micros-previousMicros);
+            energyAtOpen-=sampleEnergy(p, p.micros-previousMicros);
+            }
+          previousMicros=p.micros;
+          scaleSample(p);
+          logSample(p);
+          }
+        if (pretriggerWritten>0) {
+          chargeAtOpen-=sampleCharge(s, s.micros-previousMicros);
+          energyAtOpen-=sampleEnergy(s, s.micros-previousMicros);
+          }
+        scaleSample(s);
         }
         else{
-          Serial.println(F("issue writing logfile to SD Card"));
+          if (!serialStream) {
+            Serial.println(F("issue writing logfile to SD Card"));
+            }
           // usually the SD card is missing, let's wait 10 secs 
           // and then reboot
           delay(10000);
           reboot();
         } 
-
-      // write updated INI File; 
-      // include updated iter value - so, logfile names remain unique
-      SD.remove(INIfilename);
-      File INIFile;
-      INIFile = SD.open(INIfilename, FILE_WRITE);
-      if (INIFile){
-        Serial.print(F("Writing inifile "));
-        Serial.print(INIfilename);
-        Serial.print(F(" with iter="));
-        Serial.print(iter);
-        Serial.print(F(", freq="));
-        Serial.print(freq, 10);
-        Serial.print(F(", busVoltageThreshold="));
-        Serial.print(busVoltageThreshold, 10);
-        Serial.print(F(", currentThreshold="));
-        Serial.println(currentThreshold, 10);
-        INIFile.println(String(iter));
-        INIFile.println(String(freq,10));
-        INIFile.println(String(busVoltageThreshold,10));
-        INIFile.println(String(currentThreshold,10));
-        INIFile.close();
-        }
-      else{
-        Serial.println(F("issue writing inifile to SD Card"));
-        delay(10000);
-        reboot();
-      }
-
     }
 
     if (logging && (CyclesCondNotMet==MaxCycles)) {
       // We are currently logging, however, for MaxCycles the logging conditions were not met
       // so we transition to the non-logging state, close the logfile, increase logfile generation number iter
       // and set CyclesCondNotMet is set to MaxCycles+1
-      Serial.println(F("\nclosing logfile"));
-      logfile.close();
+      if (!serialStream) {
+        Serial.println(F("\nclosing logfile"));
+        }
+      // the last, partial window
+      if (aggregation && aggregateCount()>0) {
+        aggregateWrite(*logout, currentLSB_mA);
+        }
+      writeTrailer(*logout);
+      // loop() drops back to the configured frequency
+      burstEnd();
+      if (!serialStream) {
+        Serial.print(F("charge: "));
+        Serial.print(chargeMilliAmpHours(chargeRaw-chargeAtOpen), 6);
+        Serial.print(F(" mAh, energy: "));
+        Serial.print(energyWattHours(energyRaw-energyAtOpen), 6);
+        Serial.println(F(" Wh"));
+        }
+      writeBack.sync();
+      if (contiguous) {
+        storageCloseContiguous();
+        }
+      else {
+        logfile.close();
+        }
+      if (acquisitionMode && !serialStream) {
+        // samples lost while this logfile was open
+        Serial.print(F("sample buffer overflows: "));
+        Serial.print(samplerOverflows());
+        Serial.print(F(", late conversions: "));
+        Serial.println(samplerLateTicks());
+      }
+      // the run summary goes next to the logfile
+      char sumfn[20];
+      snprintf(sumfn, sizeof(sumfn), "log%05d.sum", iter);
+      storageRemove(sumfn);
+      File sumfile = storageOpen(sumfn, FILE_WRITE);
+      if (sumfile) {
+        writeSummary(sumfile);
+        sumfile.close();
+      }
+      // prepares the next logfile and writes the INI file; the totals survive a power-down in standby
       iter++;
+      stageLogfile();
       CyclesCondNotMet=MaxCycles+1;
       logging=false;
     }
 
+    timingMark(PHASE_PROCESS);
+
+    // the sampling rate changed since the previous record, see switchRate()
+    if (logging && RateChanged && logFormat==2) {
+      encoderWriteRate(*logout, delaytime, avgResult, ctShuntResult | (ctBusResult << 8));
+      }
+    else if (logging && RateChanged && logFormat) {
+      LogRecord rate;
+      rate.dtStatus = LOG_STATUS_RATE;
+      rate.busRaw = delaytime & 0xFFFF;
+      rate.shuntRaw = delaytime >> 16;
+      rate.currentRaw = avgResult;
+      rate.powerRaw = ctShuntResult | (ctBusResult << 8);
+      logout->write((const uint8_t*)&rate, sizeof(rate));
+      }
+    else if (logging && RateChanged) {
+      logout->print(s.millis);                logout->print(",");
+      logout->print(s.micros);                logout->print(",");
+      logout->print(F("period "));            logout->print(delaytime);
+      logout->print(F(" us"));
+      for (byte ch=0; ch<channelCount; ch++) {
+        logout->print(F(",,,"));
+        }
+      logout->print(",");
+      csvPrintTime(*logout, s.micros);
+      logout->println();
+      }
+    RateChanged=false;
+
+    // slots the scheduler skipped since the previous record, see loop(); aggregated rows
+    // show them in the number of samples instead
+    if (logging && GapSlots>0 && logFormat==2) {
+      encoderWriteGap(*logout, GapFirstSlot, GapSlots);
+      }
+    else if (logging && GapSlots>0 && logFormat) {
+      LogRecord gap;
+      gap.dtStatus = LOG_STATUS_GAP;
+      gap.busRaw = GapFirstSlot & 0xFFFF;
+      gap.shuntRaw = GapFirstSlot >> 16;
+      gap.currentRaw = GapSlots & 0xFFFF;
+      gap.powerRaw = GapSlots >> 16;
+      logout->write((const uint8_t*)&gap, sizeof(gap));
+      }
+    else if (logging && GapSlots>0 && !aggregation) {
+      logout->print(s.millis);                logout->print(",");
+      logout->print(s.micros);                logout->print(",");
+      logout->print(F("missed "));            logout->print(GapSlots);
+      logout->print(F(" from slot "));        logout->print(GapFirstSlot);
+      for (byte ch=0; ch<channelCount; ch++) {
+        logout->print(F(",,,"));
+        }
+      logout->print(",");
+      csvPrintTime(*logout, s.micros);
+      logout->println();
+      }
+    GapSlots=0;
+
   // after all this management we do some real work :-)
+    bool written=false;
     if (logging) {
-      logfile.print(millis());                logfile.print(",");
-      logfile.print(micros());                logfile.print(",");
-      logfile.print(status);                  logfile.print(",");
-      logfile.print(String(loadVoltage_V,5)); logfile.print(",");
-      logfile.print(String(current_mA,5));    logfile.print(",");
-      logfile.print(String(power_mW,5));      logfile.println();
-
-      // flushing takes around 3..7ms, so we rely on the SD library to flush when 
-      // the respective buffer ( a sector ?) is full - unless we have a delaytime > 500ms
-      if (delaytime>500000) {
-        logfile.flush();
+      written=logSample(s);
+      // a step to the previous sample starts a burst, loop() switches the rate
+      if (burstFreq>0) {
+        burstCheck(s);
         }
       }
+    else {
+      // standby: keep the most recent samples for the next logfile
+      pretriggerAdd(s);
+      }
 
+    if (logging && contiguous && storageContiguousFull()) {
+      // report once; the samples are dropped until the measurement cycle ends
+      static int reportedIter;
+      if (reportedIter!=iter) {
+        reportedIter=iter;
+        if (!serialStream) {
+          Serial.println(F("\npre-allocated logfile is full"));
+          }
+        }
+      }
+    if (written) {
+      timingMark(PHASE_WRITE);
+      }
+    else {
+      timingSkip();
+      }
+
+    // committing a sector or flushing takes around 3..7ms; writeBack does it in the slack
+    // time, see serviceIdle()
+
+  // every sample goes to the binary stream; with a sampler, the backlog after an SD card stall
+  // waits for room in the transmit queue, otherwise the frames which do not fit are dropped
+    if (serialStream) {
+      streamSample(s, acquisitionMode!=0);
+      timingMark(PHASE_SERIAL);
+      }
   // if we have enough time, we print measurements to the serial monitor as well
-    if (delaytime>=500000){
+    else if (delaytime>=500000 || (written && logInterval>=500000)){
       Serial.print(" logging ");
       Serial.print(logging);
       Serial.print(" logfile # ");
       Serial.print(iter);
-      Serial.print(F(" CyclesCondMet: ")); Serial.print(String(CyclesCondMet));
-      Serial.print(F(" CyclesCondNotMet: ")); Serial.print(String(CyclesCondNotMet));
-      Serial.print(F(" Bus[V]: ")); Serial.print(String(busVoltage_V,5));
+      Serial.print(F(" CyclesCondMet: ")); Serial.print(CyclesCondMet);
+      Serial.print(F(" CyclesCondNotMet: ")); Serial.print(CyclesCondNotMet);
+      Serial.print(F(" Bus[V]: ")); Serial.print(busVoltage_V, 5);
       Serial.print(F(" Current[mA]: ")); Serial.print(current_mA);
       Serial.println();
+      timingMark(PHASE_SERIAL);
       }
+}
 
-  // determine how much time we have left in the loop and how long to wait
-  // time up to this point can vary quite a bit, depending on the INA226 settings, SD card write operations etc
+// processes the samples the sampler of acquisition modes 1 and 2 took since the last call
+void drainSamples() {
+  Sample s;
+  while (sampleBuffer.pop(s)) {
+    timingBegin();
+    processSample(s);
+    timingEnd();
+    }
+}
+
+void loop() {
+  // send "s" on the serial monitor to get the run summary of the current logfile; not in the
+  // middle of the binary stream
+  if (Serial.available() && Serial.read()=='s' && !serialStream) {
+    writeSummary(Serial);
+    }
+  if (serialStream) {
+    streamPump();
+    }
+  // settled in standby, see standbySleep()
+  if (lowPowerStandby && !logging && CyclesCondNotMet>MaxCycles) {
+    standbySleep();
+    }
 
-    // Calculate the elapsed time since the start of the loop
-    // and delay the rest of the loop time to ensure the loop time is equal to delaytime  
-    unsigned long NowMicros=micros();
-    unsigned long MicrosElapsed;
-    if (NowMicros>StartOfLoopMicros) {
-      MicrosElapsed=NowMicros-StartOfLoopMicros;
+  if (acquisitionMode) {
+    // the timer interrupt collects the samples; we write whatever arrived since the last call,
+    // SD card stalls only let the buffer fill up for a while
+    drainSamples();
+    if (bursting!=burstActive()) {
+      // the samples taken at the old rate first
+      samplerStop();
+      drainSamples();
+      switchRate(burstActive());
+      samplerStart(channelAddresses, channelCount, delaytime);
       }
-    else {
-      // we have a rollover of the micros() counter
-      MicrosElapsed=4294967295-StartOfLoopMicros+NowMicros;
-      }
-      
-    if (MicrosElapsed<delaytime) {
-      // we have time left in the loop!
-      unsigned long RemainingDelay=delaytime-MicrosElapsed;
-
-      if (RemainingDelay>16383) {
-        // delayMicroseconds() only works well up to 16383 microseconds
-        // so we have to split the delay into two parts
-        delay(RemainingDelay/1000);
-        RemainingDelay=RemainingDelay%1000;
-        delayMicroseconds(RemainingDelay);
-        }
-      else {
-        delayMicroseconds(delaytime-MicrosElapsed);
+    // the sampler keeps filling the buffer meanwhile; half of it is our slack
+    serviceIdle(SAMPLE_BUFFER_SIZE/2*delaytime);
+    return;
+    }
+
+  timingBegin();
+
+  Sample s;
+  sensorAcquire(s);
+  timingMark(PHASE_ACQUIRE);
+  bool wasLogging=logging;
+  processSample(s);
+  unsigned long CycleMicros=timingEnd();
+
+  // tracks the 90th percentile of the overhead of the cycles which write to the open logfile: up
+  // by 9 steps if above, down by 1 step if below
+  unsigned long overhead=CycleMicros-min(CycleMicros, conversionPeriodMicros(avgResult, ctShuntResult, ctBusResult));
+  if (wasLogging && logging && overhead>overheadP90) {
+    overheadP90+=9*OVERHEAD_STEP_MICROS;
+    }
+  else if (wasLogging && logging && overheadP90>=OVERHEAD_STEP_MICROS) {
+    overheadP90-=OVERHEAD_STEP_MICROS;
+    }
+  // the grid of the new rate starts now; the conversion at the old rate may have taken longer
+  // than a slot of the new one
+  if (bursting!=burstActive()) {
+    switchRate(burstActive());
+    NextDeadline=micros();
+    }
+
+  // the deadlines are absolute, so an overrun does not shift the following slots; the
+  // signed difference of the unsigned values handles the micros() rollover
+  SlotIndex++;
+  NextDeadline+=delaytime;
+  long RemainingDelay=(long)(NextDeadline-micros());
+
+  if (RemainingDelay<=0) {
+    // delaytime was too short
+    overruns++;
+    if (!serialStream) {
+      Serial.print("X");
+      }
+    // number of slots whose deadline has passed, including the next one; the last of them
+    // is still measured if we are at most a quarter of delaytime late for it
+    unsigned long late=(unsigned long)(-RemainingDelay);
+    unsigned long behind=late/delaytime+1;
+    if (late%delaytime<=delaytime/4) {
+      behind--;
+      }
+    unsigned long skip=behind;
+    if (catchUpPolicy==1) {
+      skip=behind>MAX_BURST_SLOTS ? behind-MAX_BURST_SLOTS : 0;
+      }
+    if (skip>0) {
+      if (GapSlots==0) {
+        GapFirstSlot=SlotIndex;
         }
-        //Serial.print("!");
-        //Serial.println(MicrosElapsed);
-        //Serial.print("!");
+      GapSlots+=skip;
+      missedSlots+=skip;
+      SlotIndex+=skip;
+      NextDeadline+=skip*delaytime;
+      RemainingDelay=(long)(NextDeadline-micros());
       }
-    else {
-      // delaytime was too short
-      Serial.print("X");
-      // Serial.println(MicrosElapsed);
+    }
+
+  // SD card work which was held back, if it fits; data which waited too long is written anyway
+  serviceIdle(max(RemainingDelay,0L));
+  RemainingDelay=(long)(NextDeadline-micros());
+  if (serialStream && RemainingDelay>0) {
+    streamFlush(RemainingDelay);
+    RemainingDelay=(long)(NextDeadline-micros());
+    }
+
+  if (RemainingDelay>0) {
+    // we have time left until the next slot!
+    if (RemainingDelay>16383) {
+      // delayMicroseconds() only works well up to 16383 microseconds
+      // so we have to split the delay into two parts
+      delay(RemainingDelay/1000);
+      RemainingDelay=RemainingDelay%1000;
       }
+    delayMicroseconds(RemainingDelay);
+    }
   } // end of loop()
   
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "pretrigger.h"
+
+// the INA226 bus voltage register is 15 bit, bit 15 is always 0
+const uint16_t OVERFLOW_BIT = 0x8000;
+
+static uint8_t *buffer;
+static byte channelCount = 1;
+static uint8_t entrySize;
+static unsigned int capacity;
+// index of the oldest entry and number of entries
+static unsigned int first;
+static unsigned int count;
+
+void pretriggerBegin(byte channels, unsigned int maxSamples, uint8_t *memory, size_t bytes) {
+  buffer = memory;
+  channelCount = channels;
+  entrySize = sizeof(uint32_t) + channels * sizeof(ChannelSample);
+  capacity = min(maxSamples, (unsigned int)(bytes / entrySize));
+  pretriggerClear();
+}
+
+unsigned int pretriggerCapacity() {
+  return capacity;
+}
+
+void pretriggerAdd(const Sample &s) {
+  if (capacity == 0) {
+    return;
+  }
+  unsigned int index = first + count;
+  if (index >= capacity) {
+    index -= capacity;
+  }
+  if (count < capacity) {
+    count++;
+  }
+  else if (++first == capacity) {
+    first = 0;
+  }
+  uint8_t *p = buffer + index * entrySize;
+  uint32_t micros = s.micros;
+  memcpy(p, &micros, sizeof(micros));
+  p += sizeof(micros);
+  for (byte ch = 0; ch < channelCount; ch++) {
+    ChannelSample c = s.ch[ch];
+    if (s.flags & (SAMPLE_OVERFLOW << ch)) {
+      c.busRaw |= OVERFLOW_BIT;
+    }
+    memcpy(p, &c, sizeof(c));
+    p += sizeof(c);
+  }
+}
+
+unsigned int pretriggerCount() {
+  return count;
+}
+
+bool pretriggerPeek(Sample &s, unsigned long nowMillis, unsigned long nowMicros) {
+  if (count == 0) {
+    return false;
+  }
+  const uint8_t *p = buffer + first * entrySize;
+  uint32_t micros;
+  memcpy(&micros, p, sizeof(micros));
+  p += sizeof(micros);
+  s.micros = micros;
+  s.millis = nowMillis - (nowMicros - micros) / 1000;
+  s.flags = 0;
+  for (byte ch = 0; ch < channelCount; ch++) {
+    ChannelSample &c = s.ch[ch];
+    memcpy(&c, p, sizeof(c));
+    p += sizeof(c);
+    if (c.busRaw & OVERFLOW_BIT) {
+      c.busRaw &= ~OVERFLOW_BIT;
+      s.flags |= SAMPLE_OVERFLOW << ch;
+    }
+  }
+  return true;
+}
+
+bool pretriggerPop(Sample &s, unsigned long nowMillis, unsigned long nowMicros) {
+  if (!pretriggerPeek(s, nowMillis, nowMicros)) {
+    return false;
+  }
+  if (++first == capacity) {
+    first = 0;
+  }
+  count--;
+  return true;
+}
+
+void pretriggerClear() {
+  first = 0;
+  count = 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+// Pre-trigger buffer (LOGGER.INI line 15)
+//
+// A logfile is opened only after the threshold conditions were met for SwitchTime, so the
+// samples of the first moments of an event, e.g. the inrush current, would be gone by then.
+// While the logger waits in standby, every sample goes into this ring buffer as well, which
+// always holds the most recent ones; a new logfile starts with them, like the pre-trigger of
+// an oscilloscope.
+//
+// The buffer has no RAM of its own: it takes the part of the sample buffer's memory the
+// acquisition mode leaves unused, see sampler.h. A sample is stored as micros() and the
+// register values of the channels in use, with the overflow flag in the unused top bit of the
+// bus voltage register, i.e. 4 + 8 bytes per channel instead of sizeof(Sample); millis() is
+// derived from micros() when the samples are read back.
+
+#include "hal.h"
+
+// keeps up to maxSamples of the given number of channels, or as many as fit into the bytes of
+// memory, and empties the buffer; 0 turns it off
+void pretriggerBegin(byte channels, unsigned int maxSamples, uint8_t *memory, size_t bytes);
+// number of samples the buffer holds when it is full
+unsigned int pretriggerCapacity();
+// adds a sample, dropping the oldest one if the buffer is full
+void pretriggerAdd(const Sample &s);
+unsigned int pretriggerCount();
+// the oldest sample, without removing it; millis is derived from the given sample time, e.g.
+// the one of the sample which started the logfile. False if the buffer is empty.
+bool pretriggerPeek(Sample &s, unsigned long nowMillis, unsigned long nowMicros);
+// the same, and removes it
+bool pretriggerPop(Sample &s, unsigned long nowMillis, unsigned long nowMicros);
+void pretriggerClear();
@@ -0,0 +1,73 @@
+#pragma once
+// Lock-free single producer / single consumer ring buffer
+//
+// The producer (an interrupt service routine) only writes head, the consumer (loop())
+// only writes tail. Both indices are single bytes, so reads and writes are atomic on
+// the AVR without disabling interrupts. One slot is kept free to tell "full" from "empty",
+// i.e. the buffer holds up to SIZE-1 items. setSlots() uses only the first slots, the memory of
+// the others can be lent to a buffer which is in use at the same time, see memory().
+
+#include <stdint.h>
+
+// keeps the compiler from moving the item copy behind the index update
+#define RINGBUFFER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+template <typename T, uint8_t SIZE>
+class RingBuffer {
+  static_assert(SIZE >= 2 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2 between 2 and 128");
+
+public:
+  // producer side; returns false and counts an overflow if the buffer is full
+  bool push(const T &item) {
+    uint8_t h = head;
+    uint8_t next = (h + 1) & mask;
+    if (next == tail) {
+      overflows++;
+      return false;
+    }
+    items[h] = item;
+    RINGBUFFER_BARRIER();
+    head = next;
+    return true;
+  }
+
+  // consumer side; returns false if the buffer is empty
+  bool pop(T &item) {
+    uint8_t t = tail;
+    if (t == head) {
+      return false;
+    }
+    item = items[t];
+    RINGBUFFER_BARRIER();
+    tail = (t + 1) & mask;
+    return true;
+  }
+
+  uint8_t count() const { return (uint8_t)(head - tail) & mask; }
+  uint8_t slots() const { return mask + 1; }
+
+  // slots is a power of 2 up to SIZE; only call while the producer is stopped
+  void setSlots(uint8_t slots) {
+    mask = slots - 1;
+    clear();
+  }
+
+  // the memory of all SIZE slots
+  uint8_t *memory() { return (uint8_t *)items; }
+
+  // only call while the producer is stopped
+  void clear() {
+    head = 0;
+    tail = 0;
+    overflows = 0;
+  }
+
+  // number of items the producer had to drop; 16 bit, so read it with interrupts disabled
+  volatile uint16_t overflows = 0;
+
+private:
+  T items[SIZE];
+  uint8_t mask = SIZE - 1;
+  volatile uint8_t head = 0;
+  volatile uint8_t tail = 0;
+};
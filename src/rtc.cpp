@@ -1,17 +1,22 @@
 #include <Wire.h> // must be included here so that Arduino library object file references work
 #include <RtcDS1307.h>
+#include "hal.h"
 RtcDS1307<TwoWire> Rtc(Wire);
 
 void printDateTime(const RtcDateTime& dt);
 
 
 // handy routine to return true if there was an error
-// but it will also print out an error message with the given topic
-bool wasError(const char* errorTopic = "")
+// but it will also print out an error message with the given topic, unless messages is false
+bool wasError(const char* errorTopic = "", bool messages = true)
 {
     uint8_t error = Rtc.LastError();
     if (error != 0)
     {
+        if (!messages)
+        {
+            return true;
+        }
         // we have a communications error
         // see https://www.arduino.cc/reference/en/language/functions/communication/wire/endtransmission/
         // for what the number means
@@ -129,4 +134,51 @@ void printDateTime(const RtcDateTime& dt)
             dt.Minute(),
             dt.Second() );
     Serial.print(datestring);
-}
\ No newline at end of file
+}
+
+static bool readDateTime(DateTime &now, bool messages)
+{
+    // handle invalid RTC info
+    if (!Rtc.IsDateTimeValid()) 
+    {
+        if (!wasError("IsDateTimeValid in loop()", messages) && messages)
+        {
+            // Common Causes:
+            //    1) the battery on the device is low or even missing and the power line was disconnected
+            Serial.println(F("Lost confidence in RTC DateTime!"));
+        }
+    }
+
+    RtcDateTime dt = Rtc.GetDateTime();
+    if (wasError("GetDateTime in loop", messages))
+    {
+        return false;
+    }
+    now.year = dt.Year();
+    now.month = dt.Month();
+    now.day = dt.Day();
+    now.hour = dt.Hour();
+    now.minute = dt.Minute();
+    now.second = dt.Second();
+    return true;
+}
+
+void rtcStartSquareWave(byte pin, void (*onEdge)())
+{
+    Wire.setClock(I2C_RTC_CLOCK);
+    Rtc.SetSquareWavePin(DS1307SquareWaveOut_1Hz);
+    wasError("SetSquareWavePin 1Hz");
+    Wire.setClock(I2C_FAST_CLOCK);
+    // SQW/OUT is an open drain output
+    pinMode(pin, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(pin), onEdge, FALLING);
+}
+
+bool rtcGetDateTime(DateTime &now, bool messages)
+{
+    // the INA226 run the bus at 400kHz, the DS1307 only supports 100kHz
+    Wire.setClock(I2C_RTC_CLOCK);
+    bool ok = readDateTime(now, messages);
+    Wire.setClock(I2C_FAST_CLOCK);
+    return ok;
+}
@@ -0,0 +1,288 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include "sampler.h"
+
+// The Wire library of the megaAVR core is interrupt driven and can not be used from within
+// an interrupt service routine. So the interrupts talk to the TWI0 peripheral directly,
+// in polled mode. At 400kHz one register read takes around 120us, a complete sample
+// (flags, shunt and bus registers, trigger of the next conversion) around 460us per INA226;
+// current and power are derived from the shunt register, see deriveCurrentPower(). With more
+// than one device this exceeds the 1ms millis() tick, so the millis() timer interrupt gets
+// the high priority level and interrupts ours; micros() and millis() remain correct.
+
+RingBuffer<Sample, SAMPLE_BUFFER_SIZE> sampleBuffer;
+
+// INA226 registers
+const byte CONF_REGISTER = 0x00;
+const byte SHUNT_REGISTER = 0x01;
+const byte BUS_REGISTER = 0x02;
+const byte CALIBRATION_REGISTER = 0x05;
+const byte MASK_ENABLE_REGISTER = 0x06;
+// flags in the Mask/Enable register
+const uint16_t CONVERSION_READY_FLAG = 0x0008;
+const uint16_t MATH_OVERFLOW_FLAG = 0x0004;
+// operating mode bits of the configuration register; "shunt and bus, triggered"
+const uint16_t MODE_MASK = 0x0007;
+const uint16_t MODE_TRIGGERED = 0x0003;
+
+// TCB2 is not used by the Arduino core on the Nano Every; it is clocked by TCA0 which
+// the core runs at 16MHz/64, i.e. one timer tick is 4 microseconds
+const unsigned long MICROS_PER_TICK = 4;
+
+static byte inaAddresses[MAX_CHANNELS];
+static byte channelCount;
+static uint16_t calibration[MAX_CHANNELS];
+// ALERT pin in continuous mode, NOT_AN_INTERRUPT with the timer
+static byte alertPin = NOT_AN_INTERRUPT;
+static uint16_t confTrigger;
+static unsigned int chunksPerSample;
+static unsigned int chunksLeft;
+static bool primed;
+static bool running;
+static volatile unsigned int lateTicks;
+
+// waits for the given TWI master flag; false on timeout, bus error or lost arbitration
+static bool twiWait(uint8_t flag) {
+  unsigned int timeout = 2000;
+  while (!(TWI0.MSTATUS & flag)) {
+    if (--timeout == 0) {
+      return false;
+    }
+  }
+  return !(TWI0.MSTATUS & (TWI_ARBLOST_bm | TWI_BUSERR_bm));
+}
+
+// sends start condition and address, true if the device acknowledged
+static bool twiStart(uint8_t address) {
+  TWI0.MADDR = address;
+  return twiWait(address & 1 ? TWI_RIF_bm : TWI_WIF_bm) && !(TWI0.MSTATUS & TWI_RXACK_bm);
+}
+
+static bool twiWriteByte(uint8_t data) {
+  TWI0.MDATA = data;
+  return twiWait(TWI_WIF_bm) && !(TWI0.MSTATUS & TWI_RXACK_bm);
+}
+
+static void twiStop() {
+  TWI0.MCTRLB = TWI_ACKACT_NACK_gc | TWI_MCMD_STOP_gc;
+}
+
+static bool readRegister(byte inaAddress, byte reg, uint16_t *val) {
+  if (!twiStart(inaAddress << 1) || !twiWriteByte(reg) || !twiStart((inaAddress << 1) | 1)) {
+    twiStop();
+    return false;
+  }
+  uint8_t msb = TWI0.MDATA;
+  TWI0.MCTRLB = TWI_ACKACT_ACK_gc | TWI_MCMD_RECVTRANS_gc;
+  if (!twiWait(TWI_RIF_bm)) {
+    twiStop();
+    return false;
+  }
+  uint8_t lsb = TWI0.MDATA;
+  twiStop();
+  *val = (msb << 8) | lsb;
+  return true;
+}
+
+static bool writeRegister(byte inaAddress, byte reg, uint16_t val) {
+  bool ok = twiStart(inaAddress << 1) && twiWriteByte(reg) && twiWriteByte(val >> 8) && twiWriteByte(val & 0xFF);
+  twiStop();
+  return ok;
+}
+
+// reads the Mask/Enable register and, if a conversion is ready, the results of one device;
+// reading Mask/Enable also releases the latched ALERT pin. In CONTINUOUS mode only the first
+// device has to be ready, the others deliver their latest conversion.
+static bool readChannel(Sample &s, byte i, bool mustBeReady) {
+  ChannelSample &c = s.ch[i];
+  uint16_t maskEnable, shunt;
+  if (readRegister(inaAddresses[i], MASK_ENABLE_REGISTER, &maskEnable)
+      && (!mustBeReady || (maskEnable & CONVERSION_READY_FLAG))
+      && readRegister(inaAddresses[i], SHUNT_REGISTER, &shunt) && readRegister(inaAddresses[i], BUS_REGISTER, &c.busRaw)) {
+    c.shuntRaw = shunt;
+    if (!deriveCurrentPower(c, calibration[i]) || (maskEnable & MATH_OVERFLOW_FLAG)) {
+      s.flags |= SAMPLE_OVERFLOW << i;
+    }
+    return true;
+  }
+  return false;
+}
+
+// reads the conversions of all devices into sampleBuffer
+static void readConversion() {
+  Sample s;
+  s.millis = millis();
+  s.micros = micros();
+  s.flags = 0;
+  bool ok = true;
+  for (byte i = 0; i < channelCount && ok; i++) {
+    ok = readChannel(s, i, i == 0 || alertPin == NOT_AN_INTERRUPT);
+  }
+  if (ok) {
+    sampleBuffer.push(s);
+  }
+  else {
+    // the conversion takes longer than delaytime, or the I2C bus had an issue
+    lateTicks++;
+  }
+}
+
+// triggers the next conversion on all devices
+static bool triggerConversion() {
+  bool ok = true;
+  for (byte i = 0; i < channelCount; i++) {
+    ok = writeRegister(inaAddresses[i], CONF_REGISTER, confTrigger) && ok;
+  }
+  return ok;
+}
+
+// keep the Wire interrupt handler out of our transactions
+static uint8_t twiBegin() {
+  uint8_t mctrla = TWI0.MCTRLA;
+  TWI0.MCTRLA = mctrla & ~(TWI_RIEN_bm | TWI_WIEN_bm | TWI_SMEN_bm);
+  return mctrla;
+}
+
+static void twiEnd(uint8_t mctrla) {
+  TWI0.MCTRLA = mctrla;
+}
+
+// reads the result of the conversion triggered by the previous tick and triggers the next one
+ISR(TCB2_INT_vect) {
+  TCB2.INTFLAGS = TCB_CAPT_bm;
+  // periods longer than the 16 bit timer allows are split into several chunks
+  if (--chunksLeft) {
+    return;
+  }
+  chunksLeft = chunksPerSample;
+
+  uint8_t mctrla = twiBegin();
+  if (primed) {
+    readConversion();
+  }
+  primed = triggerConversion();
+  twiEnd(mctrla);
+}
+
+// the INA226 pulls ALERT low when a conversion in CONTINUOUS mode is ready
+static void alertISR() {
+  uint8_t mctrla = twiBegin();
+  readConversion();
+  twiEnd(mctrla);
+}
+
+// reads a register with the Wire library, i.e. outside of the interrupt
+static uint16_t wireReadRegister(byte inaAddress, byte reg) {
+  Wire.beginTransmission(inaAddress);
+  Wire.write(reg);
+  Wire.endTransmission(false);
+  Wire.requestFrom(inaAddress, (uint8_t)2);
+  uint16_t val = Wire.read() << 8;
+  val |= Wire.read();
+  return val;
+}
+
+// remembers the devices and their calibration and lets the millis() timer interrupt (TCB3 on the Nano Every)
+// interrupt the sampler's, see above
+static void useDevices(const byte *i2cAddresses, byte channels) {
+  channelCount = channels;
+  for (byte i = 0; i < channelCount; i++) {
+    inaAddresses[i] = i2cAddresses[i];
+    calibration[i] = wireReadRegister(inaAddresses[i], CALIBRATION_REGISTER);
+  }
+  CPUINT.LVL1VEC = TCB3_INT_vect_num;
+}
+
+void samplerStart(const byte *i2cAddresses, byte channels, unsigned long periodMicros) {
+  useDevices(i2cAddresses, channels);
+  // keep AVG and CT, but make sure every write of the configuration register triggers a conversion;
+  // all devices have the same settings
+  confTrigger = (wireReadRegister(inaAddresses[0], CONF_REGISTER) & ~MODE_MASK) | MODE_TRIGGERED;
+
+  unsigned long ticks = max(1UL, periodMicros / MICROS_PER_TICK);
+  chunksPerSample = ticks / 65536 + 1;
+  chunksLeft = 1;
+  primed = false;
+  sampleBuffer.clear();
+  lateTicks = 0;
+
+  TCB2.CTRLA = 0;
+  TCB2.CTRLB = TCB_CNTMODE_INT_gc;
+  TCB2.CCMP = ticks / chunksPerSample - 1;
+  TCB2.CNT = 0;
+  TCB2.INTFLAGS = TCB_CAPT_bm;
+  TCB2.INTCTRL = TCB_CAPT_bm;
+  TCB2.CTRLA = TCB_CLKSEL_CLKTCA_gc | TCB_ENABLE_bm;
+  running = true;
+}
+
+void samplerStartContinuous(const byte *i2cAddresses, byte channels, byte pin) {
+  useDevices(i2cAddresses, channels);
+  alertPin = pin;
+  sampleBuffer.clear();
+  lateTicks = 0;
+
+  // ALERT is open drain
+  pinMode(alertPin, INPUT_PULLUP);
+  running = true;
+  samplerResume();
+}
+
+void samplerStop() {
+  samplerSuspend();
+  TCB2.CTRLA = 0;
+  running = false;
+  alertPin = NOT_AN_INTERRUPT;
+}
+
+void samplerSuspend() {
+  if (!running) {
+    return;
+  }
+  if (alertPin != NOT_AN_INTERRUPT) {
+    detachInterrupt(digitalPinToInterrupt(alertPin));
+  }
+  else {
+    TCB2.INTCTRL = 0;
+  }
+}
+
+void samplerResume() {
+  if (!running) {
+    return;
+  }
+  if (alertPin != NOT_AN_INTERRUPT) {
+    attachInterrupt(digitalPinToInterrupt(alertPin), alertISR, FALLING);
+    // ALERT is latched; if a conversion finished while we were suspended, the falling
+    // edge is gone and we have to fetch the result ourselves, otherwise ALERT stays low
+    noInterrupts();
+    if (digitalRead(alertPin) == LOW) {
+      alertISR();
+    }
+    interrupts();
+  }
+  else {
+    TCB2.INTCTRL = TCB_CAPT_bm;
+  }
+}
+
+unsigned int samplerOverflows() {
+  noInterrupts();
+  unsigned int overflows = sampleBuffer.overflows;
+  interrupts();
+  return overflows;
+}
+
+unsigned int samplerLateTicks() {
+  noInterrupts();
+  unsigned int late = lateTicks;
+  interrupts();
+  return late;
+}
+
+void samplerResetCounters() {
+  noInterrupts();
+  sampleBuffer.overflows = 0;
+  lateTicks = 0;
+  interrupts();
+}
@@ -0,0 +1,42 @@
+#pragma once
+// Interrupt paced acquisition of INA226 samples
+//
+// With acquisition mode 1 (sixth line of the INI file) a timer interrupt reads the INA226
+// every delaytime microseconds and stores the sample in sampleBuffer. loop() drains the
+// buffer and writes the samples to the SD card. So, when the SD library needs 14ms to
+// commit a sector, the samples taken in the meantime wait in the buffer instead of being
+// delayed.
+//
+// With acquisition mode 2 the INA226 runs in CONTINUOUS mode and pulls its ALERT pin low
+// whenever a conversion is ready; the pin interrupt reads the sample. The sample rate is
+// given by the INA226 clock, i.e. AVG x (bus CT + shunt CT), and the MCU does not wait
+// for conversions at all.
+
+#include "hal.h"
+#include "ringbuffer.h"
+
+// number of samples the buffer can hold is SAMPLE_BUFFER_SIZE-1; with 32 and 100Hz
+// the buffer bridges SD card stalls of up to 310ms. Acquisition mode 0 does not use it, and
+// with pre-trigger samples modes 1 and 2 use half of it; the rest holds the pre-trigger buffer.
+#define SAMPLE_BUFFER_SIZE 32
+
+extern RingBuffer<Sample, SAMPLE_BUFFER_SIZE> sampleBuffer;
+
+// starts the timer; the INA226 devices must be configured (AVG, CT, calibration) before
+void samplerStart(const byte *i2cAddresses, byte channels, unsigned long periodMicros);
+// the INA226 devices must be in CONTINUOUS mode, the first one with a latched conversion
+// ready alert; the others are read whenever the first one has a conversion ready
+void samplerStartContinuous(const byte *i2cAddresses, byte channels, byte alertPin);
+void samplerStop();
+
+// the interrupt uses the I2C bus directly, so loop() must suspend the sampler
+// around its own Wire transactions, e.g. reading the RTC; a tick which occurs while
+// the sampler is suspended is handled when it is resumed
+void samplerSuspend();
+void samplerResume();
+
+// number of samples lost because the buffer was full, and number of ticks where the
+// INA226 had not finished the conversion yet
+unsigned int samplerOverflows();
+unsigned int samplerLateTicks();
+void samplerResetCounters();
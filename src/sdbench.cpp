@@ -0,0 +1,224 @@
+#include "sdbench.h"
+#include "csvrow.h"
+#include "logencoder.h"
+#include "logformat.h"
+#include "looptiming.h"
+#include "sampler.h"
+#include "timebase.h"
+#include "writeback.h"
+
+// the scratch file is removed afterwards, the report stays on the card
+static const char BENCH_FILE[] = "SDBENCH.TMP";
+static const char REPORT_FILE[] = "SDBENCH.TXT";
+
+enum BenchPattern { BENCH_CSV, BENCH_BINARY, BENCH_DELTA, BENCH_PREALLOCATED, BENCH_PATTERNS };
+
+const char PATTERN_NAMES[BENCH_PATTERNS][21] PROGMEM = {
+  "csv", "binary", "delta", "binary pre-allocated"
+};
+
+struct BenchResult {
+  byte pattern;
+  unsigned long records;
+  uint32_t bytes;
+  unsigned long stalls;
+  unsigned long longestMicros;
+  float freqMode0;
+  float freqBuffered;
+};
+
+// passes the data on and counts it
+class CountingPrint : public Print {
+public:
+  explicit CountingPrint(Print *target) : bytes(0), out(target) {}
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    size_t n = out->write(buffer, size);
+    bytes += n;
+    return n;
+  }
+  using Print::write;
+
+  uint32_t bytes;
+
+private:
+  Print *out;
+};
+
+static uint32_t noise = 1;
+
+// the next sample of a steady load, 12V and ~500mA with a few LSB of noise, 100 per second
+static void nextSample(Sample &s, byte channels) {
+  s.millis += 10;
+  s.micros += 10000;
+  s.flags = 0;
+  for (byte ch = 0; ch < channels; ch++) {
+    noise = noise * 1103515245UL + 12345;
+    s.ch[ch].busRaw = 9600 + ((noise >> 16) & 3);
+    s.ch[ch].shuntRaw = 2000 + ((noise >> 20) & 15) - 8;
+    deriveCurrentPower(s.ch[ch], 2048);
+  }
+}
+
+// writes a sample the way the logfiles of the pattern get it; the number of bytes written
+static uint32_t writeSample(CountingPrint &out, byte pattern, const Sample &s, byte channels) {
+  uint32_t before = out.bytes;
+  if (pattern == BENCH_CSV) {
+    csvWriteRow(out, s);
+  }
+  else if (pattern == BENCH_DELTA) {
+    encoderWriteSample(out, s);
+  }
+  else {
+    LogRecord record;
+    for (byte ch = 0; ch < channels; ch++) {
+      record.dtStatus = ch == 0 ? 10000 : 0;
+      record.busRaw = s.ch[ch].busRaw;
+      record.shuntRaw = s.ch[ch].shuntRaw;
+      record.currentRaw = s.ch[ch].currentRaw;
+      record.powerRaw = s.ch[ch].powerRaw;
+      out.write((const uint8_t *)&record, sizeof(record));
+    }
+  }
+  return out.bytes - before;
+}
+
+static void writeReport(Print &out, const BenchResult &r) {
+  out.print(F("pattern,"));                   out.println((const __FlashStringHelper *)PATTERN_NAMES[r.pattern]);
+  out.print(F("records,"));                   out.println(r.records);
+  out.print(F("bytes per record,"));          out.println((float)r.bytes / r.records, 1);
+  out.print(F("MB,"));                        out.println(r.bytes / 1048576.0, 3);
+  out.print(F("stalls,"));                    out.println(r.stalls);
+  out.print(F("stalls per MB,"));             out.println(r.stalls * 1048576.0 / r.bytes, 1);
+  out.print(F("longest stall_us,"));          out.println(r.longestMicros);
+  out.print(F("max freq mode 0_Hz,"));        out.println(r.freqMode0, 1);
+  out.print(F("max freq modes 1 and 2_Hz,")); out.println(r.freqBuffered, 1);
+  timingReport(out);
+  out.println();
+}
+
+// writes SDBENCH_BYTES of the pattern to the scratch file and measures every write and flush
+static bool runPattern(byte pattern, byte channels, BenchResult &r) {
+  storageRemove(BENCH_FILE);
+  File file;
+  Print *target = NULL;
+  if (pattern == BENCH_PREALLOCATED) {
+    target = storageOpenContiguous(BENCH_FILE, 2 * SDBENCH_BYTES);
+  }
+  else {
+    file = storageOpen(BENCH_FILE, FILE_WRITE);
+    if (file) {
+      target = &file;
+    }
+  }
+  if (!target) {
+    return false;
+  }
+
+  CountingPrint out(target);
+  Sample s;
+  memset(&s, 0, sizeof(s));
+  s.millis = millis();
+  s.micros = micros();
+  TimeStamp origin;
+  timebaseAt(s.micros, origin);
+  csvSetOrigin(origin);
+  encoderBegin(s.millis, s.micros, channels);
+  timingReset();
+
+  r.pattern = pattern;
+  r.records = 0;
+  r.stalls = 0;
+  r.longestMicros = 0;
+  uint32_t totalMicros = 0;
+  unsigned long lastFlush = millis();
+  while (out.bytes < SDBENCH_BYTES) {
+    nextSample(s, channels);
+    unsigned long start = micros();
+    if (!writeSample(out, pattern, s, channels)) {
+      // a full pre-allocated file
+      break;
+    }
+    unsigned long us = micros() - start;
+    timingRecord(PHASE_WRITE, us);
+    r.records++;
+    totalMicros += us;
+    r.stalls += us > SDBENCH_STALL_MICROS;
+    r.longestMicros = max(r.longestMicros, us);
+
+    if (pattern != BENCH_PREALLOCATED && millis() - lastFlush >= WRITEBACK_FLUSH_MILLIS) {
+      start = micros();
+      file.flush();
+      us = micros() - start;
+      timingRecord(PHASE_FLUSH, us);
+      totalMicros += us;
+      r.stalls += us > SDBENCH_STALL_MICROS;
+      r.longestMicros = max(r.longestMicros, us);
+      lastFlush = millis();
+    }
+  }
+  if (pattern == BENCH_PREALLOCATED) {
+    storageCloseContiguous();
+  }
+  else {
+    file.close();
+  }
+  storageRemove(BENCH_FILE);
+  r.bytes = out.bytes;
+
+  // mode 0: writeBack moves a sector commit or a flush into the slack of each cycle
+  unsigned long slowest = max(timingPercentile(PHASE_WRITE, 99), timingPercentile(PHASE_FLUSH, 99));
+  r.freqMode0 = 1000000.0 / (timingPercentile(PHASE_WRITE, 50) + slowest);
+  // modes 1 and 2: the throughput, and the sample buffer bridges the longest stall
+  r.freqBuffered = min(r.records * 1000000.0 / max(totalMicros, 1UL),
+                       (SAMPLE_BUFFER_SIZE - 1) * 1000000.0 / max(r.longestMicros, 1UL));
+  return r.records > 0;
+}
+
+void sdBenchmark(int chipSelect, byte channels, float currentLSB_mA) {
+  csvRowBegin(currentLSB_mA, channels);
+  bool raw = storageBeginContiguous(chipSelect);
+  storageRemove(REPORT_FILE);
+
+  BenchResult best0, bestBuffered;
+  memset(&best0, 0, sizeof(best0));
+  memset(&bestBuffered, 0, sizeof(bestBuffered));
+  for (byte pattern = 0; pattern < BENCH_PATTERNS; pattern++) {
+    Serial.print(F("SD card benchmark, "));
+    Serial.print((const __FlashStringHelper *)PATTERN_NAMES[pattern]);
+    if (pattern == BENCH_PREALLOCATED && !raw) {
+      Serial.println(F(": raw SD card access failed, skipped"));
+      continue;
+    }
+    Serial.println(F(" ..."));
+    BenchResult r;
+    if (!runPattern(pattern, channels, r)) {
+      Serial.println(F("can not write the scratch file SDBENCH.TMP"));
+      continue;
+    }
+    writeReport(Serial, r);
+    File report = storageOpen(REPORT_FILE, FILE_WRITE);
+    if (report) {
+      writeReport(report, r);
+      report.close();
+    }
+    if (r.freqMode0 > best0.freqMode0) {
+      best0 = r;
+    }
+    if (r.freqBuffered > bestBuffered.freqBuffered) {
+      bestBuffered = r;
+    }
+  }
+
+  if (best0.freqMode0 > 0) {
+    Serial.print(F("SD card sustains up to "));
+    Serial.print(best0.freqMode0, 1);
+    Serial.print(F(" Hz in acquisition mode 0 ("));
+    Serial.print((const __FlashStringHelper *)PATTERN_NAMES[best0.pattern]);
+    Serial.print(F(") and up to "));
+    Serial.print(bestBuffered.freqBuffered, 1);
+    Serial.print(F(" Hz in modes 1 and 2 ("));
+    Serial.print((const __FlashStringHelper *)PATTERN_NAMES[bestBuffered.pattern]);
+    Serial.println(F("), see SDBENCH.TXT"));
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+// SD card benchmark (LOGGER.INI line 17)
+//
+// Qualifies an SD card before it goes into the field, instead of finding the slow ones by their
+// overruns. At power-up the logger writes synthetic log traffic of the configured channels to a
+// scratch file, SDBENCH_BYTES per pattern: CSV rows, binary records and delta encoded samples
+// to a growing file, which is flushed every WRITEBACK_FLUSH_MILLIS like a logfile, and binary
+// records to a pre-allocated, contiguous file. Every write of a record and every flush is
+// timed. The report goes to Serial and to SDBENCH.TXT: per pattern the bytes per record,
+// the write and flush histograms of looptiming.h, the stalls (writes or flushes of more than
+// SDBENCH_STALL_MICROS) per MB and the highest frequency the card sustains:
+//   acquisition mode 0: one record and one sector commit or flush per cycle (see writeback.h),
+//     i.e. 1 / (p50 write + p99 of writes and flushes)
+//   acquisition modes 1 and 2: the average throughput, and the sample buffer must bridge the
+//     longest stall, i.e. min(records / total time, (SAMPLE_BUFFER_SIZE-1) / longest stall)
+// These are SD card figures; the conversion and the I2C time of a measurement come on top.
+
+#include "hal.h"
+
+#define SDBENCH_BYTES (512UL * 1024)
+#define SDBENCH_STALL_MICROS 2000
+
+// currentLSB_mA as for csvBegin(); the SD card must be initialized
+void sdBenchmark(int chipSelect, byte channels, float currentLSB_mA);
@@ -0,0 +1,94 @@
+#include "stream.h"
+#include "ringbuffer.h"
+
+static RingBuffer<uint8_t, STREAM_QUEUE_SIZE> queue;
+static StreamInfo info;
+static uint16_t sequence;
+static unsigned int framesSinceInfo;
+static unsigned long drops;
+
+// sends queued bytes, waiting for Serial, until the queue has room for a frame of length
+static void makeRoom(uint8_t length) {
+  uint8_t b;
+  while (STREAM_QUEUE_SIZE - 1 - queue.count() < STREAM_FRAME_HEADER + length + STREAM_FRAME_CRC && queue.pop(b)) {
+    Serial.write(b);
+  }
+}
+
+// queues a frame if the queue has room for all of it; the sequence number is used either way
+static bool sendFrame(uint8_t type, const uint8_t *payload, uint8_t length, bool wait) {
+  uint16_t seq = sequence++;
+  if (wait) {
+    makeRoom(length);
+  }
+  if (STREAM_QUEUE_SIZE - 1 - queue.count() < STREAM_FRAME_HEADER + length + STREAM_FRAME_CRC) {
+    drops++;
+    return false;
+  }
+  uint8_t header[STREAM_FRAME_HEADER] = {STREAM_SYNC0, STREAM_SYNC1, type, length, (uint8_t)seq, (uint8_t)(seq >> 8)};
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < STREAM_FRAME_HEADER; i++) {
+    queue.push(header[i]);
+    if (i >= 2) {
+      crc = streamCrc(crc, header[i]);
+    }
+  }
+  for (uint8_t i = 0; i < length; i++) {
+    queue.push(payload[i]);
+    crc = streamCrc(crc, payload[i]);
+  }
+  queue.push(crc & 0xFF);
+  queue.push(crc >> 8);
+  return true;
+}
+
+void streamBegin(float currentRange, unsigned long delaytime, const byte *i2cAddresses, byte channels) {
+  info.currentRange = currentRange;
+  info.delaytime = delaytime;
+  info.channels = channels;
+  memset(info.channelAddress, 0, sizeof(info.channelAddress));
+  memcpy(info.channelAddress, i2cAddresses, min(channels, (byte)sizeof(info.channelAddress)));
+  framesSinceInfo = STREAM_INFO_INTERVAL;
+  drops = 0;
+}
+
+void streamSample(const Sample &s, bool wait) {
+  // until it was sent, the info frame is tried again with every sample
+  if (framesSinceInfo >= STREAM_INFO_INTERVAL && sendFrame(STREAM_TYPE_INFO, (const uint8_t *)&info, sizeof(info), wait)) {
+    framesSinceInfo = 0;
+  }
+  uint8_t payload[sizeof(StreamSample) + MAX_CHANNELS * sizeof(StreamChannel)];
+  StreamSample head = {(uint32_t)s.micros, s.flags};
+  memcpy(payload, &head, sizeof(head));
+  uint8_t length = sizeof(head);
+  for (byte ch = 0; ch < info.channels; ch++) {
+    StreamChannel c = {s.ch[ch].busRaw, s.ch[ch].shuntRaw, s.ch[ch].currentRaw, s.ch[ch].powerRaw};
+    memcpy(payload + length, &c, sizeof(c));
+    length += sizeof(c);
+  }
+  sendFrame(STREAM_TYPE_SAMPLE, payload, length, wait);
+  framesSinceInfo++;
+  streamPump();
+}
+
+void streamPump() {
+  int room = Serial.availableForWrite();
+  uint8_t b;
+  while (room-- > 0 && queue.pop(b)) {
+    Serial.write(b);
+  }
+}
+
+void streamFlush(unsigned long budget) {
+  streamPump();
+  // the Serial transmit buffer is full now, so every further byte waits for one to go out
+  uint8_t b;
+  while (budget >= STREAM_BYTE_MICROS && queue.pop(b)) {
+    Serial.write(b);
+    budget -= STREAM_BYTE_MICROS;
+  }
+}
+
+unsigned long streamDrops() {
+  return drops;
+}
@@ -0,0 +1,32 @@
+#pragma once
+// Sends every sample as a binary frame over Serial, see streamformat.h
+//
+// Frames are put into a transmit queue in RAM and moved to the Serial transmit buffer by
+// streamPump() as far as it has room, so sending does not block the measurement cycle. After an
+// SD card stall the sampler of acquisition modes 1 and 2 hands over its backlog at once; those
+// frames wait for room instead, the sampler keeps measuring meanwhile. In acquisition mode 0
+// streamFlush() sends the queue during the wait for the next slot. A frame which still does not
+// fit into the queue is dropped as a whole; its sequence number is used anyway, so the receiver
+// can count the drops. At 460800 baud a frame of one channel (21 bytes) takes 0.46ms, i.e.
+// around 2000 samples per second can be sent.
+
+#include "hal.h"
+#include "streamformat.h"
+
+// bytes of the transmit queue, a power of 2 up to 128
+#define STREAM_QUEUE_SIZE 128
+// baud rate of Serial and the time a byte takes at it
+#define STREAM_BAUD 460800
+#define STREAM_BYTE_MICROS (10000000UL/STREAM_BAUD+1)
+
+// starts the stream with an info frame
+void streamBegin(float currentRange, unsigned long delaytime, const byte *i2cAddresses, byte channels);
+// queues the frame of a sample, preceded by an info frame every STREAM_INFO_INTERVAL frames;
+// with wait, a full queue is sent until the frames fit instead of dropping them
+void streamSample(const Sample &s, bool wait);
+// moves queued bytes to Serial without blocking; call it as often as possible
+void streamPump();
+// sends queued bytes, waiting for Serial, as far as they go out within budget microseconds
+void streamFlush(unsigned long budget);
+// number of frames dropped because the queue was full
+unsigned long streamDrops();
@@ -0,0 +1,62 @@
+#pragma once
+// Binary live stream over Serial (LOGGER.INI line 16)
+//
+// This header is shared by the firmware and tools/streamrecv.cpp, so it must only use fixed
+// width types and no Arduino specific definitions. All values are little endian.
+//
+// The stream is a sequence of frames
+//   sync      STREAM_SYNC0, STREAM_SYNC1
+//   type      STREAM_TYPE_SAMPLE or STREAM_TYPE_INFO
+//   length    number of payload bytes
+//   sequence  uint16, counts every frame the firmware produced, including the ones it had to
+//             drop because the transmit queue was full; a receiver sees drops as sequence gaps
+//   payload
+//   crc       uint16 streamCrc() of type, length, sequence and payload
+// The firmware prints its power-up messages as text before the first frame and no text while it
+// streams; a receiver skips everything which is not a frame with a valid CRC.
+//
+// The payload of a sample frame is a StreamSample followed by a StreamChannel per channel. An
+// info frame with the calibration precedes the first sample frame and repeats every
+// STREAM_INFO_INTERVAL frames, so a receiver can start at any time.
+
+#include <stdint.h>
+
+#define STREAM_SYNC0          0xA5
+#define STREAM_SYNC1          0x5A
+#define STREAM_TYPE_SAMPLE    1
+#define STREAM_TYPE_INFO      2
+#define STREAM_INFO_INTERVAL  256
+// sync, type, length, sequence
+#define STREAM_FRAME_HEADER   6
+#define STREAM_FRAME_CRC      2
+
+struct __attribute__((packed)) StreamInfo {
+  float    currentRange;      // A, as passed to setResistorRange(); the current LSB is currentRange/32768
+  uint32_t delaytime;         // time between two measurements in microseconds
+  uint8_t  channels;          // number of INA226 devices
+  uint8_t  channelAddress[4]; // their I2C addresses, 0 for unused entries
+};
+
+struct __attribute__((packed)) StreamSample {
+  uint32_t micros;            // micros() of the sample
+  uint8_t  flags;             // bit i set if channel i reported an overflow
+};
+
+struct __attribute__((packed)) StreamChannel {
+  uint16_t busRaw;            // INA226 registers, as in LogRecord
+  int16_t  shuntRaw;
+  int16_t  currentRaw;
+  uint16_t powerRaw;
+};
+
+// CRC-16 with the reflected CCITT polynomial 0x8408 and the initial value 0xFFFF, one byte at a
+// time without a table; the same as _crc_ccitt_update() of avr-libc
+static inline uint16_t streamCrc(uint16_t crc, uint8_t data) {
+  data ^= (uint8_t)crc;
+  data ^= (uint8_t)(data << 4);
+  return (uint16_t)((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+static_assert(sizeof(StreamInfo) == 13, "StreamInfo layout changed");
+static_assert(sizeof(StreamSample) == 5, "StreamSample layout changed");
+static_assert(sizeof(StreamChannel) == 8, "StreamChannel layout changed");
@@ -0,0 +1,168 @@
+#include "timebase.h"
+
+// a period between two edges within these bounds is one RTC second; the MCU clock is not off
+// by more than 3%
+static const unsigned long SECOND_MIN_MICROS = 970000;
+static const unsigned long SECOND_MAX_MICROS = 1030000;
+
+// set by the edge interrupt: micros() of the last edge and its second since the epoch
+static volatile unsigned long edgeMicros;
+static volatile uint32_t edgeSeconds;
+// length of an RTC second in 1/16 microseconds of micros()
+static volatile uint32_t second16 = 16000000UL;
+static volatile bool measured;
+// the first edge was seen (or waited for in vain), edgeSeconds counts from there
+static volatile bool started;
+// the last edge was an edge of the RTC, not one made up by timebaseAt()
+static volatile bool locked;
+
+static DateTime epoch;
+static bool epochValid;
+
+// (1000000 - second) / second in units of 2^-24, for the second16 it was calculated for
+static uint32_t scaleSecond16;
+static int32_t correction24;
+
+static void onEdge() {
+  unsigned long now = micros();
+  if (!started) {
+    edgeMicros = now;
+    started = true;
+    locked = true;
+    return;
+  }
+  unsigned long period = now - edgeMicros;
+  uint32_t seconds;
+  if (period >= SECOND_MIN_MICROS && period <= SECOND_MAX_MICROS) {
+    seconds = 1;
+    if (locked && measured) {
+      // the interrupt waits while the sampler interrupt reads the INA226, so the edges are
+      // seen up to a few hundred microseconds late; a loop filter follows them instead of
+      // taking each as it is
+      uint32_t second = second16 / 16;
+      long error = (long)(period - second);
+      second16 += error;
+      edgeMicros += second + error / 4;
+      edgeSeconds++;
+      return;
+    }
+    if (locked) {
+      second16 = period * 16;
+      measured = true;
+    }
+  }
+  else {
+    // edges were missed, or the last edge was made up; keep the seconds whole
+    uint32_t second = second16 / 16;
+    seconds = (period + second / 2) / second;
+    if (seconds == 0) {
+      // a glitch
+      return;
+    }
+  }
+  edgeSeconds += seconds;
+  edgeMicros = now;
+  locked = true;
+}
+
+void timebaseBegin(byte sqwPin) {
+  started = false;
+  locked = false;
+  measured = false;
+  edgeSeconds = 0;
+  rtcStartSquareWave(sqwPin, onEdge);
+  unsigned long start = millis();
+  while (!started && millis() - start < 1100) {
+    delay(1);
+  }
+  // right after the edge the RTC has just advanced to second 0
+  epochValid = rtcGetDateTime(epoch);
+  noInterrupts();
+  if (!started) {
+    // no square wave, the time base runs on micros() from now on
+    edgeMicros = micros();
+    started = true;
+  }
+  interrupts();
+}
+
+bool timebaseLocked() {
+  noInterrupts();
+  unsigned long last = edgeMicros;
+  bool isLocked = locked;
+  interrupts();
+  return isLocked && micros() - last <= 2 * SECOND_MAX_MICROS;
+}
+
+bool timebaseEpoch(DateTime &t) {
+  t = epoch;
+  return epochValid;
+}
+
+unsigned long timebaseSecondMicros() {
+  noInterrupts();
+  uint32_t s = second16;
+  interrupts();
+  return (s + 8) / 16;
+}
+
+void timebaseResume(uint32_t second) {
+  noInterrupts();
+  // the next edge is 0.5 to 1.5 seconds of micros() away, and so counts as the next second
+  edgeMicros = micros() - second16 / 32;
+  edgeSeconds = second;
+  locked = false;
+  interrupts();
+}
+
+void timebaseAt(unsigned long micros_, TimeStamp &t) {
+  noInterrupts();
+  unsigned long anchor = edgeMicros;
+  uint32_t seconds = edgeSeconds;
+  uint32_t s16 = second16;
+  interrupts();
+
+  // without edges the anchor is moved on by whole seconds of micros(), so the micros() values
+  // of the last and the next 35 minutes stay within reach
+  uint32_t second = s16 / 16;
+  unsigned long late = micros() - anchor;
+  if (late > 2 * SECOND_MAX_MICROS) {
+    uint32_t skipped = late / second - 1;
+    noInterrupts();
+    if (edgeMicros == anchor) {
+      edgeMicros = anchor + skipped * second;
+      edgeSeconds = seconds + skipped;
+      locked = false;
+    }
+    anchor = edgeMicros;
+    seconds = edgeSeconds;
+    interrupts();
+  }
+
+  if (s16 != scaleSecond16) {
+    scaleSecond16 = s16;
+    correction24 = ((int64_t)(16000000L - (int32_t)s16) << 24) / (int32_t)s16;
+  }
+  // microseconds of micros() since the edge, scaled to RTC microseconds
+  int32_t since = micros_ - anchor;
+  since += (int32_t)(((int64_t)since * correction24) >> 24);
+  int32_t whole = since / 1000000L;
+  int32_t fraction = since % 1000000L;
+  if (fraction < 0) {
+    fraction += 1000000L;
+    whole--;
+  }
+  t.seconds = seconds + whole;
+  t.micros = fraction;
+}
+
+void timebaseSince(const TimeStamp &from, const TimeStamp &to, uint32_t &seconds, uint32_t &micros_) {
+  seconds = to.seconds - from.seconds;
+  if (to.micros >= from.micros) {
+    micros_ = to.micros - from.micros;
+  }
+  else {
+    micros_ = to.micros + 1000000UL - from.micros;
+    seconds--;
+  }
+}
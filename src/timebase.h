@@ -0,0 +1,39 @@
+#pragma once
+// Time base disciplined by the 1Hz square wave of the DS1307
+//
+// micros() runs on the MCU clock, which is off by a fraction of a percent and drifts
+// with the temperature, and it wraps after 71 minutes. The DS1307 pulls its SQW/OUT pin low
+// once a second, when its seconds advance; the edge interrupt counts these seconds and notes
+// the micros() of the last edge. A micros() value is then converted into seconds since the
+// epoch, the RTC second read when the time base started, plus the microseconds since the
+// edge of that second, scaled with the measured length of an RTC second in micros(). So the
+// timestamps keep the accuracy of the RTC over days, do not wrap and are computed without
+// any I2C traffic.
+//
+// Without edges (SQW/OUT not connected) the time base runs on micros() alone.
+
+#include "hal.h"
+
+// a point in time of the time base: seconds since the epoch and microseconds (0..999999)
+struct TimeStamp {
+  uint32_t seconds;
+  uint32_t micros;
+};
+
+// starts the time base on the SQW/OUT pin of the DS1307 connected to pin; waits for the
+// first edge (at most 1.1s) and reads the RTC right after it, which gives the epoch
+void timebaseBegin(byte sqwPin);
+// true if the last edge is at most 2 seconds old, i.e. the time base follows the RTC
+bool timebaseLocked();
+// the date and time of second 0; false if the RTC could not be read
+bool timebaseEpoch(DateTime &epoch);
+// length of an RTC second in micros(), as measured, e.g. 1000000 for an exact MCU clock
+unsigned long timebaseSecondMicros();
+// after a sleep in which micros() stood still: continues at second since the epoch, the RTC
+// second read right after waking; its fraction is taken as half a second until the next edge
+// finds the right one. The times of micros() values from before the sleep are lost.
+void timebaseResume(uint32_t second);
+// the time of a micros() value of the last 35 minutes, or of the next 35 minutes
+void timebaseAt(unsigned long micros, TimeStamp &t);
+// to - from in seconds and microseconds (0..999999); to must not be earlier than from
+void timebaseSince(const TimeStamp &from, const TimeStamp &to, uint32_t &seconds, uint32_t &micros);
@@ -0,0 +1,130 @@
+#include "writeback.h"
+
+WriteBack writeBack;
+
+void WriteBack::begin(Print *out, File *file) {
+  this->out = out;
+  this->file = file;
+  fill = 0;
+  position = 0;
+  dirty = false;
+  forced = 0;
+}
+
+// bytes which can be passed on without completing the current sector or starting the next
+// one; the SD library commits a sector when the next one is started, the simulator when it
+// is complete, so both are held back
+size_t WriteBack::roomInSector() const {
+  uint16_t offset = position % 512;
+  return offset == 0 && position > 0 ? 0 : 511 - offset;
+}
+
+// follows a new peak right away, otherwise moves an eighth of the way down
+static unsigned long estimate(unsigned long current, unsigned long measured) {
+  return measured > current ? measured : current - (current - measured) / 8;
+}
+
+size_t WriteBack::write(const uint8_t *buffer, size_t size) {
+  if (!holding) {
+    commit();
+    // a write beyond the current sector commits it
+    bool commits = size > roomInSector();
+    unsigned long start = micros();
+    out->write(buffer, size);
+    if (commits) {
+      commitMicros = estimate(commitMicros, micros() - start);
+    }
+    position += size;
+    if (!dirty && file) {
+      dirty = true;
+      dirtySince = millis();
+    }
+    return size;
+  }
+  size_t direct = 0;
+  if (fill == 0) {
+    direct = min(size, roomInSector());
+    out->write(buffer, direct);
+    position += direct;
+  }
+  size_t rest = size - direct;
+  if (fill + rest > sizeof(held)) {
+    // there was no slack for a while, or the record is too large: write it now
+    forced++;
+    commit();
+    out->write(buffer + direct, rest);
+    position += rest;
+  }
+  else {
+    memcpy(held + fill, buffer + direct, rest);
+    fill += rest;
+  }
+  // pre-allocated logfiles only ever write full sectors, their data is safe once committed
+  if (!dirty && (file || fill > 0)) {
+    dirty = true;
+    dirtySince = millis();
+  }
+  return size;
+}
+
+void WriteBack::commit() {
+  if (fill == 0) {
+    return;
+  }
+  unsigned long start = micros();
+  out->write(held, fill);
+  unsigned long took = micros() - start;
+  commitMicros = estimate(commitMicros, took);
+  position += fill;
+  fill = 0;
+  if (!file) {
+    dirty = false;
+  }
+}
+
+void WriteBack::flushFile() {
+  unsigned long start = micros();
+  file->flush();
+  unsigned long took = micros() - start;
+  flushMicros = estimate(flushMicros, took);
+  dirty = false;
+}
+
+bool WriteBack::expired() const {
+  return dirty && millis() - dirtySince >= WRITEBACK_MAX_DIRTY_MILLIS;
+}
+
+bool WriteBack::service(unsigned long slackMicros) {
+  bool wrote = false;
+  if (fill > 0) {
+    if (slackMicros < commitMicros) {
+      if (!expired()) {
+        return false;
+      }
+      forced++;
+    }
+    unsigned long start = micros();
+    commit();
+    slackMicros -= min(slackMicros, micros() - start);
+    wrote = true;
+  }
+  if (file && dirty && millis() - dirtySince >= WRITEBACK_FLUSH_MILLIS) {
+    if (slackMicros < flushMicros) {
+      if (!expired()) {
+        return wrote;
+      }
+      forced++;
+    }
+    flushFile();
+    wrote = true;
+  }
+  return wrote;
+}
+
+void WriteBack::sync() {
+  commit();
+  if (file) {
+    flushFile();
+  }
+  dirty = false;
+}
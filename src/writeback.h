@@ -0,0 +1,72 @@
+#pragma once
+// Sector commits and flushes of the logfile in the slack time of the measurement cycle
+//
+// The SD library commits its 512 byte sector buffer when the first byte of the next sector is
+// written, and updates the FAT when that sector starts a new cluster; flush() writes the sector
+// and the directory entry. Each takes milliseconds and, done within the write of a record,
+// lands on the sampling path. WriteBack passes the data on as long as it stays within the
+// current sector and holds back the bytes which would complete it. loop() calls service()
+// with the time left until the next deadline; the held back bytes are committed, and the file
+// is flushed, only if the measured cost fits. Data older than WRITEBACK_MAX_DIRTY_MILLIS is
+// written regardless, which bounds what a power loss takes, and so is the buffer when it is full.
+// Pre-allocated logfiles are written the same way, but have nothing to flush.
+//
+// Holding back only pays if there is slack to commit in: in acquisition mode 0 without a slack
+// reserve (see sdReserve() in main.cpp) the held back bytes are forced out within a later
+// write, together with the records which piled up behind them. Without holding, the data is
+// passed on as it comes and the commits are timed there; service() still flushes.
+
+#include "hal.h"
+
+// bytes held back; a record of one channel fits, larger ones may be written right away
+#define WRITEBACK_BUFFER_BYTES 96
+// data is flushed once it is this old and the slack allows it
+#define WRITEBACK_FLUSH_MILLIS 500
+// data is committed and flushed once it is this old, even without slack
+#define WRITEBACK_MAX_DIRTY_MILLIS 2000
+
+class WriteBack : public Print {
+public:
+  // writes to out, which is at the start of a sector (i.e. an empty file); file is flushed,
+  // NULL for pre-allocated logfiles
+  void begin(Print *out, File *file);
+  // holds back the bytes which complete a sector (the default), or passes everything on
+  void setHolding(bool on) { holding = on; }
+  // uses up to slackMicros for committing the held back bytes and flushing; the time taken
+  // is that of the actual SD card operations, as measured before. True if anything was written.
+  bool service(unsigned long slackMicros);
+  // writes everything and flushes, e.g. before the logfile is closed
+  void sync();
+  // the slack a commit, or with flushes a commit or a flush, needs according to the measurements
+  unsigned long reserveMicros(bool flushes) const { return flushes ? max(commitMicros, flushMicros) : commitMicros; }
+  // number of commits and flushes done without slack since begin()
+  unsigned int forcedCount() const { return forced; }
+
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+private:
+  size_t roomInSector() const;
+  void commit();
+  void flushFile();
+  bool expired() const;
+
+  Print *out;
+  File *file;
+  uint8_t held[WRITEBACK_BUFFER_BYTES];
+  uint8_t fill;
+  // bytes passed on to out
+  uint32_t position;
+  // data written since the last flush (or, without file, held back)
+  bool dirty;
+  unsigned long dirtySince;
+  // peak costs, decaying towards the measured ones, so the rare FAT update is not forgotten right
+  // away; the SD library takes around 3..7ms
+  unsigned long commitMicros = 3000;
+  unsigned long flushMicros = 7000;
+  unsigned int forced;
+  bool holding = true;
+};
+
+extern WriteBack writeBack;
@@ -0,0 +1,441 @@
+// logdecode - converts a binary PowerLogger logfile (logNNNNN.bin) into the CSV format
+// the logger writes in CSV mode (logNNNNN.csv)
+//
+// Build on the host, e.g.
+//   g++ -O2 -o logdecode tools/logdecode.cpp src/csvformat.cpp
+//
+// Usage
+//   logdecode log00042.bin               writes the CSV to stdout
+//   logdecode log00042.bin log00042.csv  writes the CSV to the given file
+//   logdecode - < log00042.bin           reads the logfile from stdin
+//
+// Logfiles of several INA226 channels get one column group per channel, as in CSV mode.
+// Both encodings (log format 1 and 2) are read as a stream, without seeking. A delta encoded
+// file is read up to the first damaged data, e.g. after a power loss, and from the next intact
+// keyframe on.
+//
+// The values are formatted by src/csvformat.cpp of the firmware, so they are the same text
+// as in CSV mode. millis is derived from the micros deltas, i.e. it may differ by a
+// millisecond from the value millis() would have returned. time_s is the header's
+// startOffsetMicros plus the deltas, in 64 bit, so it does not wrap.
+
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include "../src/csvformat.h"
+#include "../src/logformat.h"
+
+static bool readVarint(FILE *in, uint32_t &v) {
+  v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    int b = fgetc(in);
+    if (b == EOF) {
+      return false;
+    }
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// the register values of one channel
+struct Registers {
+  uint16_t busRaw;
+  int16_t shuntRaw;
+  int16_t currentRaw;
+  uint16_t powerRaw;
+};
+
+struct Decoder {
+  FILE *out;
+  LogHeader header;
+  unsigned channels;
+  float currentLSB_mA;
+  unsigned long long elapsedMicros;
+  unsigned long long startOffsetMicros;
+  unsigned long records;
+  // a gap or rate record is printed with the time of the next record, as in CSV mode
+  uint32_t gapFirstSlot;
+  uint32_t gapSlots;
+  bool rateChanged;
+  uint32_t rateDelaytime;
+};
+
+// prints one measurement of all channels; overflow is set if any channel reported one
+static void printSample(Decoder &d, uint32_t dt, bool overflow, const Registers *regs) {
+  d.elapsedMicros += dt;
+  uint32_t micros = d.header.startMicros + (uint32_t)d.elapsedMicros;
+  uint32_t millis = d.header.startMillis + (uint32_t)(d.elapsedMicros / 1000);
+  unsigned long long time = d.startOffsetMicros + d.elapsedMicros;
+  char timeText[32];
+  snprintf(timeText, sizeof(timeText), "%llu.%06llu", time / 1000000, time % 1000000);
+
+  if (d.rateChanged) {
+    fprintf(d.out, "%lu,%lu,period %lu us", (unsigned long)millis, (unsigned long)micros,
+            (unsigned long)d.rateDelaytime);
+    for (unsigned ch = 0; ch < d.channels; ch++) {
+      fprintf(d.out, ",,,");
+    }
+    fprintf(d.out, ",%s\r\n", timeText);
+    d.rateChanged = false;
+  }
+  if (d.gapSlots) {
+    fprintf(d.out, "%lu,%lu,missed %lu from slot %lu", (unsigned long)millis, (unsigned long)micros,
+            (unsigned long)d.gapSlots, (unsigned long)d.gapFirstSlot);
+    for (unsigned ch = 0; ch < d.channels; ch++) {
+      fprintf(d.out, ",,,");
+    }
+    fprintf(d.out, ",%s\r\n", timeText);
+    d.gapSlots = 0;
+  }
+  fprintf(d.out, "%lu,%lu,%s", (unsigned long)millis, (unsigned long)micros, overflow ? "overflow" : "ok");
+  char values[CSV_VALUES_CHARS];
+  for (unsigned ch = 0; ch < d.channels; ch++) {
+    const Registers &r = regs[ch];
+    fwrite(values, 1, csvAppendValues(values, r.busRaw, r.shuntRaw, r.currentRaw, r.powerRaw) - values, d.out);
+  }
+  fprintf(d.out, ",%s\r\n", timeText);
+  d.records++;
+}
+
+static void printTrailer(Decoder &d, const LogTrailer &trailer) {
+  // same conversion as chargeMilliAmpHours() and energyWattHours() in the firmware
+  fprintf(d.out, "Charge_mAh, %.6f, total, %.6f\r\n", (float)trailer.chargeRaw * d.currentLSB_mA / 3.6e9,
+          trailer.totalCharge_mAh);
+  fprintf(d.out, "Energy_Wh, %.6f, total, %.6f\r\n", (float)trailer.energyRaw * 25.0 * d.currentLSB_mA / 3.6e12,
+          trailer.totalEnergy_Wh);
+}
+
+static Registers recordRegisters(const LogRecord &record) {
+  Registers r = {record.busRaw, record.shuntRaw, record.currentRaw, record.powerRaw};
+  return r;
+}
+
+static int decodeFixed(FILE *in, Decoder &d, const char *inName) {
+  LogRecord record;
+  Registers regs[LOG_MAX_CHANNELS];
+  while (fread(&record, 1, sizeof(record), in) == sizeof(record)) {
+    if (record.dtStatus == LOG_STATUS_TRAILER) {
+      LogTrailer trailer;
+      if (fread(&trailer, 1, sizeof(trailer), in) != sizeof(trailer)) {
+        fprintf(stderr, "%s: truncated trailer\n", inName);
+        return 1;
+      }
+      printTrailer(d, trailer);
+      return 0;
+    }
+    if (record.dtStatus == LOG_STATUS_RATE) {
+      d.rateDelaytime = record.busRaw | ((uint32_t)(uint16_t)record.shuntRaw << 16);
+      d.rateChanged = true;
+      d.records++;
+      continue;
+    }
+    if (record.dtStatus & LOG_STATUS_GAP) {
+      d.gapFirstSlot = record.busRaw | ((uint32_t)(uint16_t)record.shuntRaw << 16);
+      d.gapSlots = (uint16_t)record.currentRaw | ((uint32_t)record.powerRaw << 16);
+      d.records++;
+      continue;
+    }
+    // the records of the further channels of the measurement
+    bool overflow = record.dtStatus & LOG_STATUS_OVERFLOW;
+    regs[0] = recordRegisters(record);
+    unsigned ch = 1;
+    for (; ch < d.channels; ch++) {
+      LogRecord more;
+      if (fread(&more, 1, sizeof(more), in) != sizeof(more)) {
+        break;
+      }
+      overflow = overflow || (more.dtStatus & LOG_STATUS_OVERFLOW);
+      regs[ch] = recordRegisters(more);
+    }
+    if (ch < d.channels) {
+      break;
+    }
+    printSample(d, record.dtStatus & LOG_DT_MASK, overflow, regs);
+  }
+  // a partial record at the end of the file is the result of a power loss while logging
+  if (ferror(in)) {
+    fprintf(stderr, "%s: read error after %lu records\n", inName, d.records);
+    return 1;
+  }
+  return 0;
+}
+
+// reads the LogKeyframeChannels following a keyframe into regs[1..]; false if one is damaged
+static bool readKeyframeChannels(FILE *in, const Decoder &d, Registers *regs) {
+  for (unsigned ch = 1; ch < d.channels; ch++) {
+    LogKeyframeChannel c;
+    if (fread(&c, 1, sizeof(c), in) != sizeof(c) || logChecksum((const uint8_t *)&c, sizeof(c) - 1) != c.checksum) {
+      return false;
+    }
+    Registers r = {c.busRaw, c.shuntRaw, c.currentRaw, c.powerRaw};
+    regs[ch] = r;
+  }
+  return true;
+}
+
+// reads the rest of a keyframe whose first byte was read; false if it is damaged
+static bool readKeyframe(FILE *in, const Decoder &d, LogKeyframe &k, Registers *regs) {
+  k.sync[0] = LOG_TAG_KEYFRAME;
+  if (fread((uint8_t *)&k + 1, 1, sizeof(k) - 1, in) != sizeof(k) - 1) {
+    return false;
+  }
+  return memcmp(k.sync, LOG_KEYFRAME_SYNC, sizeof(k.sync)) == 0 &&
+         logChecksum((const uint8_t *)&k, sizeof(k) - 1) == k.checksum && readKeyframeChannels(in, d, regs);
+}
+
+// skips to the next intact keyframe, false at the end of the file
+static bool resync(FILE *in, const Decoder &d, LogKeyframe &k, Registers *regs) {
+  uint8_t window[sizeof(LogKeyframe)];
+  size_t filled = fread(window, 1, sizeof(window), in);
+  while (filled == sizeof(window)) {
+    memcpy(&k, window, sizeof(k));
+    if (memcmp(k.sync, LOG_KEYFRAME_SYNC, sizeof(k.sync)) == 0 &&
+        logChecksum(window, sizeof(k) - 1) == k.checksum) {
+      if (readKeyframeChannels(in, d, regs)) {
+        return true;
+      }
+      // the channel data is damaged, look for the next keyframe
+      filled = fread(window, 1, sizeof(window), in);
+      continue;
+    }
+    memmove(window, window + 1, sizeof(window) - 1);
+    int b = fgetc(in);
+    if (b == EOF) {
+      break;
+    }
+    window[sizeof(window) - 1] = b;
+  }
+  return false;
+}
+
+// reads the nibbles and varints of a sample entry whose tag was read, from field firstField on, and
+// returns the differences; false if the data ends
+static bool readEntry(FILE *in, int tag, int firstField, int32_t *delta) {
+  uint32_t fields[LOG_FIELDS] = {0};
+  int nibbles = 0;
+  for (int i = firstField; i < LOG_FIELDS; i++) {
+    if (tag & (1 << i)) {
+      nibbles++;
+    }
+  }
+  uint8_t packed[3];
+  int packedBytes = (nibbles + 1) / 2;
+  if (fread(packed, 1, packedBytes, in) != (size_t)packedBytes) {
+    return false;
+  }
+  int nibble = 0;
+  for (int i = firstField; i < LOG_FIELDS; i++) {
+    if (tag & (1 << i)) {
+      fields[i] = (packed[nibble / 2] >> (nibble % 2 * 4)) & 0x0F;
+      nibble++;
+    }
+  }
+  for (int i = firstField; i < LOG_FIELDS; i++) {
+    if (!(tag & (1 << i)) && !readVarint(in, fields[i])) {
+      return false;
+    }
+  }
+  // zigzag back to signed
+  for (int i = 0; i < LOG_FIELDS; i++) {
+    delta[i] = (int32_t)(fields[i] >> 1) ^ -(int32_t)(fields[i] & 1);
+  }
+  return true;
+}
+
+// adds the differences of an entry to the register values, the sums wrap like the firmware's
+static void applyEntry(Registers &r, const int32_t *delta) {
+  r.busRaw += delta[1];
+  r.shuntRaw += delta[2];
+  r.currentRaw += delta[3];
+  r.powerRaw += delta[4];
+}
+
+static int decodeDelta(FILE *in, Decoder &d, const char *inName) {
+  uint32_t sample = 0;
+  uint32_t sinceKeyframe = LOG_KEYFRAME_INTERVAL;
+  uint32_t prevDt = 0;
+  Registers prev[LOG_MAX_CHANNELS];
+  memset(prev, 0, sizeof(prev));
+
+  for (;;) {
+    int tag = fgetc(in);
+    if (tag == EOF) {
+      break;
+    }
+    bool damaged = false;
+    LogKeyframe k;
+    Registers keyRegs[LOG_MAX_CHANNELS];
+    if (tag == LOG_TAG_KEYFRAME) {
+      damaged = !readKeyframe(in, d, k, keyRegs);
+    } else if (tag == LOG_TAG_TRAILER) {
+      LogTrailer trailer;
+      if (fread(&trailer, 1, sizeof(trailer), in) != sizeof(trailer)) {
+        break;
+      }
+      printTrailer(d, trailer);
+      return 0;
+    } else if (tag == LOG_TAG_GAP) {
+      damaged = !readVarint(in, d.gapFirstSlot) || !readVarint(in, d.gapSlots);
+      if (!damaged) {
+        d.records++;
+        continue;
+      }
+    } else if (tag == LOG_TAG_RATE) {
+      uint32_t averageMode, convTimes;
+      damaged = !readVarint(in, d.rateDelaytime) || !readVarint(in, averageMode) || !readVarint(in, convTimes);
+      if (!damaged) {
+        d.rateChanged = true;
+        d.records++;
+        continue;
+      }
+    } else if (tag > (LOG_TAG_OVERFLOW | 0x1F) || sinceKeyframe >= LOG_KEYFRAME_INTERVAL) {
+      // a keyframe is due before every LOG_KEYFRAME_INTERVAL-th sample
+      damaged = true;
+    } else {
+      int32_t delta[LOG_FIELDS];
+      Registers next[LOG_MAX_CHANNELS];
+      memcpy(next, prev, sizeof(next));
+      bool overflow = tag & LOG_TAG_OVERFLOW;
+      damaged = !readEntry(in, tag, 0, delta);
+      uint32_t dt = prevDt + delta[0];
+      applyEntry(next[0], delta);
+      // the entries of the further channels have no dt field
+      for (unsigned ch = 1; ch < d.channels && !damaged; ch++) {
+        int channelTag = fgetc(in);
+        if (channelTag == EOF || (channelTag & 1) || channelTag > (LOG_TAG_OVERFLOW | 0x1F) ||
+            !readEntry(in, channelTag, 1, delta)) {
+          damaged = true;
+          break;
+        }
+        overflow = overflow || (channelTag & LOG_TAG_OVERFLOW);
+        applyEntry(next[ch], delta);
+      }
+      if (!damaged) {
+        prevDt = dt;
+        memcpy(prev, next, sizeof(prev));
+        printSample(d, prevDt, overflow, prev);
+        sample++;
+        sinceKeyframe++;
+        continue;
+      }
+    }
+
+    if (damaged) {
+      if (!resync(in, d, k, keyRegs)) {
+        break;
+      }
+      fprintf(stderr, "%s: damaged data after sample %lu, continuing at sample %lu\n", inName,
+              (unsigned long)sample, (unsigned long)k.sample);
+      // the time since the start, from the millis() and micros() of the keyframe
+      unsigned long long estimate = (unsigned long long)(uint32_t)(k.millis - d.header.startMillis) * 1000;
+      int32_t correction = (int32_t)((uint32_t)(k.micros - d.header.startMicros) - (uint32_t)estimate);
+      d.elapsedMicros = estimate + correction;
+    } else if (k.sample != sample) {
+      fprintf(stderr, "%s: keyframe of sample %lu at sample %lu\n", inName, (unsigned long)k.sample,
+              (unsigned long)sample);
+    }
+    sample = k.sample;
+    sinceKeyframe = 0;
+    prevDt = k.dt;
+    Registers first = {k.busRaw, k.shuntRaw, k.currentRaw, k.powerRaw};
+    keyRegs[0] = first;
+    memcpy(prev, keyRegs, sizeof(Registers) * d.channels);
+  }
+  if (ferror(in)) {
+    fprintf(stderr, "%s: read error after %lu records\n", inName, d.records);
+    return 1;
+  }
+  return 0;
+}
+
+static int decode(FILE *in, FILE *out, const char *inName) {
+  Decoder d;
+  d.out = out;
+  d.elapsedMicros = 0;
+  d.records = 0;
+  d.gapFirstSlot = 0;
+  d.gapSlots = 0;
+  d.rateChanged = false;
+  LogHeader &header = d.header;
+
+  if (fread(&header, 1, sizeof(header), in) < sizeof(header) || memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0) {
+    fprintf(stderr, "%s: not a PowerLogger binary logfile\n", inName);
+    return 1;
+  }
+  bool delta = header.encoding == LOG_ENCODING_DELTA;
+  if (header.version != LOG_FORMAT_VERSION || header.headerSize < sizeof(header) ||
+      (!delta && header.recordSize != sizeof(LogRecord)) || header.encoding > LOG_ENCODING_DELTA) {
+    fprintf(stderr, "%s: unsupported format version %u\n", inName, header.version);
+    return 1;
+  }
+  // skip header extensions written by newer firmware
+  for (size_t i = sizeof(header); i < header.headerSize; i++) {
+    fgetc(in);
+  }
+
+  d.channels = header.channels;
+  if (d.channels < 1 || d.channels > LOG_MAX_CHANNELS) {
+    fprintf(stderr, "%s: invalid number of channels %u\n", inName, d.channels);
+    return 1;
+  }
+
+  d.startOffsetMicros = header.startOffsetMicros;
+
+  // same scaling as INA226_WE
+  d.currentLSB_mA = header.currentRange * 1000.0f / 32768.0f;
+  if (!(d.currentLSB_mA >= FLT_MIN && d.currentLSB_mA <= CSV_MAX_CURRENT_LSB_MA)) {
+    fprintf(stderr, "%s: invalid current range %g A\n", inName, header.currentRange);
+    return 1;
+  }
+  csvBegin(d.currentLSB_mA);
+
+  if (header.rtcValid) {
+    fprintf(out, "Data measured from, %02u/%02u/%04u %02u:%02u:%02u\r\n",
+            header.day, header.month, header.year, header.hour, header.minute, header.second);
+  } else {
+    fprintf(out, "Data measured from, \r\n");
+  }
+  if (d.channels == 1) {
+    fprintf(out, "millis,micros,status,Load_Voltage,Current_mA, load_Power_mW,time_s\r\n");
+  } else {
+    fprintf(out, "millis,micros,status");
+    for (unsigned ch = 1; ch <= d.channels; ch++) {
+      fprintf(out, ",Load_Voltage_%u,Current_mA_%u, load_Power_mW_%u", ch, ch, ch);
+    }
+    fprintf(out, ",time_s\r\n");
+  }
+
+  return delta ? decodeDelta(in, d, inName) : decodeFixed(in, d, inName);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s logNNNNN.bin|- [output.csv]\n", argv[0]);
+    return 2;
+  }
+  FILE *in = strcmp(argv[1], "-") ? fopen(argv[1], "rb") : stdin;
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+  FILE *out = stdout;
+  if (argc == 3) {
+    out = fopen(argv[2], "wb");
+    if (!out) {
+      perror(argv[2]);
+      fclose(in);
+      return 1;
+    }
+  }
+  int rc = decode(in, out, argv[1]);
+  if (in != stdin) {
+    fclose(in);
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  return rc;
+}
@@ -0,0 +1,704 @@
+// logindex - indexes a directory of PowerLogger CSV logfiles (logNNNNN.csv) and answers queries
+// from the index instead of parsing the logfiles again
+//
+// Build on the host, e.g.
+//   g++ -O2 -pthread -o logindex tools/logindex.cpp
+//
+// Usage
+//   logindex build DIR [-j N]        indexes the logfiles of DIR which are new or changed since the
+//                                    last build, on N threads (default: all cores)
+//   logindex query DIR [conditions]  prints the index entries which meet all conditions as CSV
+//     --from dd/mm/yyyy[ hh:mm:ss]   the logfile started at or after
+//     --to dd/mm/yyyy[ hh:mm:ss]     the logfile started before the end of that day (or second)
+//     --current-above mA             the current exceeded mA in either direction
+//     --voltage-below V              the load voltage dropped below V
+//     --min-duration s               the logfile covers at least s seconds
+//     --overflows                    the logfile has samples with an overflow
+//     --channel N                    the conditions apply to channel N only, default: any channel
+//
+// e.g. all cycles above 5A in March 2026:
+//   logindex query logs --from 01/03/2026 --to 31/03/2026 --current-above 5000
+//
+// The index is kept in DIR/LOGINDEX.DAT, one entry per logfile: the start time of the
+// "Data measured from" line, duration, samples, missed slots, overflows and per channel the
+// min/max/mean of voltage, current and power, charge and energy. A logfile is parsed again when
+// its size or modification time changed, e.g. the current one of a logger still running.
+//
+// The logfiles are memory-mapped and parsed in place: the lines are found with memchr(), the
+// numbers are scanned as integer mantissa and decimal exponent, without strtod() and without
+// allocating per line. The columns are taken from the header line, so single and multi channel
+// logfiles, aggregated logfiles (the mean columns, weighted by the samples column) and logfiles
+// without time_s (micros is used then) are indexed alike. Charge and energy are the current and
+// power of each row times the time since the previous row, as the logger integrates them. Gap
+// rows count as missed slots, rate rows and the charge and energy lines at the end are skipped.
+// The time of the skipped slots is not taken out: the row after a gap row stands for the time
+// since the row before it, as in the logger's totals and trailer, so the index matches them and
+// the gap is filled with the current after it rather than counted as no current.
+// Binary logfiles are indexed after converting them with logdecode.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char INDEX_NAME[] = "LOGINDEX.DAT";
+static const char INDEX_MAGIC[8] = {'P', 'L', 'I', 'N', 'D', 'E', 'X', '1'};
+// start time of logfiles without a date, i.e. the RTC could not be read
+static const int64_t NO_TIME = INT64_MIN;
+// as in src/hal.h
+static const int MAX_CHANNELS = 3;
+
+struct ChannelStats {
+  float voltageMin, voltageMax, voltageMean;
+  float currentMin, currentMax, currentMean;
+  float powerMin, powerMax, powerMean;
+  double charge_mAh;
+  double energy_Wh;
+};
+
+// the layout of LOGINDEX.DAT is this struct, in host byte order; the index is a cache, a
+// different magic makes the next build start over
+struct IndexEntry {
+  char name[24];
+  int64_t fileSize;
+  int64_t fileMtime;
+  // seconds since 1970 of the start date and time, without a time zone
+  int64_t start;
+  double duration_s;
+  uint64_t samples;
+  uint64_t missedSlots;
+  uint64_t overflows;
+  uint8_t channels;
+  uint8_t aggregated;
+  uint8_t reserved[6];
+  ChannelStats ch[MAX_CHANNELS];
+};
+
+// the columns of a logfile; -1 if it has none
+enum Quantity { VOLTAGE, CURRENT, POWER, QUANTITIES };
+
+struct Columns {
+  int millis, micros, time, samples, status;
+  // the value of each row, for aggregated logfiles the mean of the window
+  int value[MAX_CHANNELS][QUANTITIES];
+  // aggregated logfiles: the min and max of the window
+  int min[MAX_CHANNELS][QUANTITIES];
+  int max[MAX_CHANNELS][QUANTITIES];
+  int count;
+  uint8_t channels;
+};
+
+// powers of ten for the decimals of the logfiles (at most 6) and some slack
+static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                               1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+
+// scans a decimal number like "-12.00400" from p up to end; false if the field is no number.
+// The digits go into an integer and are scaled once, which is exact for the up to 15 digits
+// the logger writes.
+static bool scanNumber(const char *p, const char *end, double &value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int decimals = 0;
+  bool point = false;
+  for (; p < end; p++) {
+    unsigned d = (unsigned)(*p - '0');
+    if (d < 10) {
+      if (digits < 18) {
+        mantissa = mantissa * 10 + d;
+        digits++;
+        decimals += point;
+      }
+      else if (!point) {
+        // beyond the precision of a double anyway
+        return false;
+      }
+    }
+    else if (*p == '.' && !point) {
+      point = true;
+    }
+    else if (*p != ' ' && *p != '\r') {
+      return false;
+    }
+  }
+  if (!digits) {
+    return false;
+  }
+  value = mantissa / POW10[decimals];
+  if (negative) {
+    value = -value;
+  }
+  return true;
+}
+
+// the end of the field starting at p: the next comma or end
+static const char *fieldEnd(const char *p, const char *end) {
+  const char *comma = (const char *)memchr(p, ',', end - p);
+  return comma ? comma : end;
+}
+
+// days since 1970-01-01 of a date in the proleptic Gregorian calendar
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+// "dd/mm/yyyy" or "dd/mm/yyyy hh:mm:ss"; the number of fields read, 0 if none
+static int parseDate(const char *s, int64_t &t) {
+  unsigned day, month, year, hour = 0, minute = 0, second = 0;
+  int n = sscanf(s, "%u/%u/%u %u:%u:%u", &day, &month, &year, &hour, &minute, &second);
+  if (n < 3 || month < 1 || month > 12 || day < 1 || day > 31) {
+    return 0;
+  }
+  t = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+  return n;
+}
+
+static void formatDate(int64_t t, char *buffer, size_t size) {
+  if (t == NO_TIME) {
+    snprintf(buffer, size, "unknown");
+    return;
+  }
+  time_t tt = (time_t)t;
+  struct tm tm;
+  gmtime_r(&tt, &tm);
+  snprintf(buffer, size, "%02d/%02d/%04d %02d:%02d:%02d", tm.tm_mday, tm.tm_mon + 1,
+           tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+// the channel (0-based) of a column name with a suffix "_1".."_3", or 0 without one; -1 if the
+// name does not start with prefix
+static int columnChannel(const char *name, size_t length, const char *prefix) {
+  size_t n = strlen(prefix);
+  if (length < n || memcmp(name, prefix, n)) {
+    return -1;
+  }
+  if (length == n) {
+    return 0;
+  }
+  if (length == n + 2 && name[n] == '_' && name[n + 1] >= '1' && name[n + 1] < '1' + MAX_CHANNELS) {
+    return name[n + 1] - '1';
+  }
+  return -1;
+}
+
+// maps the header line to the columns; false if it is no header of a logfile
+static bool parseHeader(const char *p, const char *end, Columns &c) {
+  memset(&c, -1, sizeof(c));
+  c.count = 0;
+  c.channels = 0;
+  struct Name {
+    const char *prefix;
+    int Columns::*single;
+    Quantity quantity;
+    // 0: value, 1: min, 2: max
+    int kind;
+  };
+  static const Name NAMES[] = {
+    {"millis", &Columns::millis, VOLTAGE, 0}, {"micros", &Columns::micros, VOLTAGE, 0},
+    {"time_s", &Columns::time, VOLTAGE, 0}, {"samples", &Columns::samples, VOLTAGE, 0},
+    {"status", &Columns::status, VOLTAGE, 0},
+    {"Load_Voltage", 0, VOLTAGE, 0}, {"Current_mA", 0, CURRENT, 0}, {"load_Power_mW", 0, POWER, 0},
+    {"V_mean", 0, VOLTAGE, 0}, {"mA_mean", 0, CURRENT, 0}, {"mW_mean", 0, POWER, 0},
+    {"V_min", 0, VOLTAGE, 1}, {"mA_min", 0, CURRENT, 1}, {"mW_min", 0, POWER, 1},
+    {"V_max", 0, VOLTAGE, 2}, {"mA_max", 0, CURRENT, 2}, {"mW_max", 0, POWER, 2},
+  };
+  while (p < end) {
+    const char *e = fieldEnd(p, end);
+    const char *name = p;
+    while (name < e && *name == ' ') {
+      name++;
+    }
+    size_t length = e - name;
+    while (length && (name[length - 1] == '\r' || name[length - 1] == ' ')) {
+      length--;
+    }
+    for (const Name &n : NAMES) {
+      if (n.single) {
+        if (strlen(n.prefix) == length && !memcmp(name, n.prefix, length)) {
+          c.*n.single = c.count;
+        }
+        continue;
+      }
+      int ch = columnChannel(name, length, n.prefix);
+      if (ch >= 0) {
+        int (*target)[QUANTITIES] = n.kind == 0 ? c.value : n.kind == 1 ? c.min : c.max;
+        target[ch][n.quantity] = c.count;
+        c.channels = std::max<uint8_t>(c.channels, ch + 1);
+      }
+    }
+    c.count++;
+    p = e + 1;
+  }
+  return c.micros >= 0 && c.channels > 0;
+}
+
+// the running statistics of a channel while a logfile is parsed
+struct Accumulator {
+  double min[QUANTITIES], max[QUANTITIES], sum[QUANTITIES];
+  double charge, energy;
+};
+
+// parses a mapped logfile into the entry; false if it is no CSV logfile
+static bool indexLogfile(const char *data, size_t size, IndexEntry &entry) {
+  const char *end = data + size;
+  const char *line = data;
+  const char *eol = (const char *)memchr(line, '\n', end - line);
+  if (!eol) {
+    return false;
+  }
+  static const char DATE_PREFIX[] = "Data measured from,";
+  if (eol - line < (long)strlen(DATE_PREFIX) || memcmp(line, DATE_PREFIX, strlen(DATE_PREFIX))) {
+    return false;
+  }
+  char date[32];
+  size_t n = std::min<size_t>(eol - line - strlen(DATE_PREFIX), sizeof(date) - 1);
+  memcpy(date, line + strlen(DATE_PREFIX), n);
+  date[n] = 0;
+  entry.start = parseDate(date + strspn(date, " "), entry.start) ? entry.start : NO_TIME;
+
+  line = eol + 1;
+  eol = (const char *)memchr(line, '\n', end - line);
+  Columns c;
+  if (!eol || !parseHeader(line, eol, c)) {
+    return false;
+  }
+  entry.channels = c.channels;
+  entry.aggregated = c.samples >= 0;
+
+  Accumulator acc[MAX_CHANNELS];
+  for (Accumulator &a : acc) {
+    for (int q = 0; q < QUANTITIES; q++) {
+      a.min[q] = INFINITY;
+      a.max[q] = -INFINITY;
+      a.sum[q] = 0;
+    }
+    a.charge = a.energy = 0;
+  }
+  // the fields of a row, as [begin, end) of the mapped data
+  std::vector<const char *> fields(2 * c.count);
+  double firstTime = 0, lastTime = 0;
+  uint32_t lastMicros = 0;
+  double micros64 = 0;
+  uint64_t rows = 0;
+  double weight = 0;
+
+  for (line = eol + 1; line < end; line = eol + 1) {
+    eol = (const char *)memchr(line, '\n', end - line);
+    if (!eol) {
+      // the last line of a logfile which is still written
+      break;
+    }
+    int count = 0;
+    for (const char *p = line; p <= eol && count < c.count; count++) {
+      const char *e = fieldEnd(p, eol);
+      fields[2 * count] = p;
+      fields[2 * count + 1] = e;
+      p = e + 1;
+    }
+    double v;
+    if (count < c.count || !scanNumber(fields[2 * c.micros], fields[2 * c.micros + 1], v)) {
+      // e.g. the charge and energy lines at the end
+      continue;
+    }
+    if (c.status >= 0) {
+      const char *s = fields[2 * c.status];
+      size_t length = fields[2 * c.status + 1] - s;
+      if (length > 7 && !memcmp(s, "missed ", 7)) {
+        // the time base runs on, so the next row's dt spans the skipped slots, see above
+        entry.missedSlots += strtoull(s + 7, NULL, 10);
+        continue;
+      }
+      if (length >= 8 && !memcmp(s, "overflow", 8)) {
+        entry.overflows++;
+      }
+      else if (!(length >= 2 && !memcmp(s, "ok", 2))) {
+        // a rate row, "period N us"
+        continue;
+      }
+    }
+
+    // the time of the row in seconds; micros() wraps after 71 minutes
+    uint32_t micros = (uint32_t)v;
+    micros64 += rows ? (uint32_t)(micros - lastMicros) : 0;
+    lastMicros = micros;
+    double t = micros64 / 1e6;
+    if (c.time >= 0 && scanNumber(fields[2 * c.time], fields[2 * c.time + 1], v)) {
+      t = v;
+    }
+    if (!rows) {
+      firstTime = lastTime = t;
+    }
+    double dt = t - lastTime;
+    lastTime = t;
+
+    double samples = 1;
+    if (c.samples >= 0 && scanNumber(fields[2 * c.samples], fields[2 * c.samples + 1], v)) {
+      samples = v;
+    }
+    for (uint8_t ch = 0; ch < c.channels; ch++) {
+      Accumulator &a = acc[ch];
+      double values[QUANTITIES] = {0, 0, 0};
+      for (int q = 0; q < QUANTITIES; q++) {
+        int col = c.value[ch][q];
+        if (col < 0 || !scanNumber(fields[2 * col], fields[2 * col + 1], values[q])) {
+          continue;
+        }
+        double lo = values[q], hi = values[q];
+        if (c.min[ch][q] >= 0) {
+          scanNumber(fields[2 * c.min[ch][q]], fields[2 * c.min[ch][q] + 1], lo);
+        }
+        if (c.max[ch][q] >= 0) {
+          scanNumber(fields[2 * c.max[ch][q]], fields[2 * c.max[ch][q] + 1], hi);
+        }
+        a.min[q] = std::min(a.min[q], lo);
+        a.max[q] = std::max(a.max[q], hi);
+        a.sum[q] += values[q] * samples;
+      }
+      a.charge += values[CURRENT] * dt / 3600.0;
+      a.energy += values[POWER] * dt / 3600.0 / 1000.0;
+    }
+    weight += samples;
+    rows++;
+  }
+
+  entry.samples = entry.aggregated ? (uint64_t)weight : rows;
+  entry.duration_s = lastTime - firstTime;
+  for (uint8_t ch = 0; ch < c.channels; ch++) {
+    Accumulator &a = acc[ch];
+    ChannelStats &s = entry.ch[ch];
+    float *mins[QUANTITIES] = {&s.voltageMin, &s.currentMin, &s.powerMin};
+    float *maxs[QUANTITIES] = {&s.voltageMax, &s.currentMax, &s.powerMax};
+    float *means[QUANTITIES] = {&s.voltageMean, &s.currentMean, &s.powerMean};
+    for (int q = 0; q < QUANTITIES; q++) {
+      *mins[q] = rows ? a.min[q] : 0;
+      *maxs[q] = rows ? a.max[q] : 0;
+      *means[q] = weight > 0 ? a.sum[q] / weight : 0;
+    }
+    s.charge_mAh = a.charge;
+    s.energy_Wh = a.energy;
+  }
+  return true;
+}
+
+// maps and indexes one logfile; false if it can not be read or is no CSV logfile
+static bool indexFile(const std::string &path, IndexEntry &entry) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror(path.c_str());
+    return false;
+  }
+  bool ok = false;
+  if (entry.fileSize > 0) {
+    void *data = mmap(NULL, entry.fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      perror(path.c_str());
+    }
+    else {
+      madvise(data, entry.fileSize, MADV_SEQUENTIAL);
+      ok = indexLogfile((const char *)data, entry.fileSize, entry);
+      munmap(data, entry.fileSize);
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+static std::string indexPath(const char *dir) {
+  return std::string(dir) + "/" + INDEX_NAME;
+}
+
+static bool readIndex(const char *dir, std::vector<IndexEntry> &entries) {
+  FILE *f = fopen(indexPath(dir).c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  char magic[sizeof(INDEX_MAGIC)];
+  bool ok = fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, INDEX_MAGIC, sizeof(magic));
+  IndexEntry e;
+  while (ok && fread(&e, sizeof(e), 1, f) == 1) {
+    entries.push_back(e);
+  }
+  fclose(f);
+  return ok;
+}
+
+// writes the index next to it and renames it, so a query never sees half an index
+static bool writeIndex(const char *dir, const std::vector<IndexEntry> &entries) {
+  std::string path = indexPath(dir);
+  std::string temporary = path + ".tmp";
+  FILE *f = fopen(temporary.c_str(), "wb");
+  if (!f) {
+    perror(temporary.c_str());
+    return false;
+  }
+  bool ok = fwrite(INDEX_MAGIC, sizeof(INDEX_MAGIC), 1, f) == 1;
+  if (ok && !entries.empty()) {
+    ok = fwrite(entries.data(), sizeof(IndexEntry), entries.size(), f) == entries.size();
+  }
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(temporary.c_str(), path.c_str())) {
+    perror(path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// logNNNNN.csv, as logfileName() of the firmware names them
+static bool isLogfile(const char *name) {
+  size_t n = strlen(name);
+  return n > 7 && n < sizeof(IndexEntry::name) && !strncasecmp(name, "log", 3)
+         && !strcasecmp(name + n - 4, ".csv");
+}
+
+static int build(const char *dir, unsigned threads) {
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  DIR *d = opendir(dir);
+  if (!d) {
+    perror(dir);
+    return 1;
+  }
+  std::vector<IndexEntry> old;
+  readIndex(dir, old);
+  std::sort(old.begin(), old.end(), [](const IndexEntry &a, const IndexEntry &b) {
+    return strcmp(a.name, b.name) < 0;
+  });
+
+  std::vector<IndexEntry> entries;
+  // the entries which need parsing
+  std::vector<size_t> pending;
+  while (struct dirent *de = readdir(d)) {
+    if (!isLogfile(de->d_name)) {
+      continue;
+    }
+    struct stat st;
+    std::string path = std::string(dir) + "/" + de->d_name;
+    if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    IndexEntry e;
+    memset(&e, 0, sizeof(e));
+    strcpy(e.name, de->d_name);
+    e.fileSize = st.st_size;
+    e.fileMtime = st.st_mtime;
+    auto it = std::lower_bound(old.begin(), old.end(), e, [](const IndexEntry &a, const IndexEntry &b) {
+      return strcmp(a.name, b.name) < 0;
+    });
+    if (it != old.end() && !strcmp(it->name, e.name) && it->fileSize == e.fileSize
+        && it->fileMtime == e.fileMtime) {
+      entries.push_back(*it);
+    }
+    else {
+      pending.push_back(entries.size());
+      entries.push_back(e);
+    }
+  }
+  closedir(d);
+
+  // the threads take the next pending logfile until there are none left
+  std::atomic<size_t> next(0);
+  std::atomic<uint64_t> bytes(0);
+  std::vector<char> valid(entries.size(), 1);
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < pending.size(); ) {
+      IndexEntry &e = entries[pending[i]];
+      valid[pending[i]] = indexFile(std::string(dir) + "/" + e.name, e);
+      bytes += e.fileSize;
+    }
+  };
+  threads = std::max(1u, std::min<unsigned>(threads, pending.size()));
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &t : pool) {
+    t.join();
+  }
+
+  // logfiles which are no CSV logfiles, e.g. empty ones, are left out and parsed again next time
+  std::vector<IndexEntry> indexed;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (valid[i]) {
+      indexed.push_back(entries[i]);
+    }
+  }
+  std::sort(indexed.begin(), indexed.end(), [](const IndexEntry &a, const IndexEntry &b) {
+    return strcmp(a.name, b.name) < 0;
+  });
+  if (!writeIndex(dir, indexed)) {
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  fprintf(stderr, "%zu logfiles indexed, %zu parsed (%.1f MB) on %u threads in %.3f s, %zu skipped\n",
+          indexed.size(), pending.size(), bytes / 1048576.0, threads, seconds,
+          entries.size() - indexed.size());
+  return 0;
+}
+
+struct Query {
+  int64_t from, to;
+  double currentAbove;
+  double voltageBelow;
+  double minDuration;
+  bool overflows;
+  // 0-based, -1 = any
+  int channel;
+};
+
+static bool channelMatches(const Query &q, const ChannelStats &s) {
+  if (!isnan(q.currentAbove) && std::max(fabsf(s.currentMin), fabsf(s.currentMax)) <= q.currentAbove) {
+    return false;
+  }
+  if (!isnan(q.voltageBelow) && s.voltageMin >= q.voltageBelow) {
+    return false;
+  }
+  return true;
+}
+
+static bool matches(const Query &q, const IndexEntry &e, uint8_t ch) {
+  if ((q.from != NO_TIME || q.to != NO_TIME) && e.start == NO_TIME) {
+    return false;
+  }
+  if ((q.from != NO_TIME && e.start < q.from) || (q.to != NO_TIME && e.start >= q.to)) {
+    return false;
+  }
+  if (e.duration_s < q.minDuration || (q.overflows && !e.overflows)) {
+    return false;
+  }
+  if (q.channel >= 0 && q.channel != ch) {
+    return false;
+  }
+  return channelMatches(q, e.ch[ch]);
+}
+
+static int query(const char *dir, const Query &q) {
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  std::vector<IndexEntry> entries;
+  if (!readIndex(dir, entries)) {
+    fprintf(stderr, "%s: no index, run 'logindex build %s' first\n", indexPath(dir).c_str(), dir);
+    return 1;
+  }
+  printf("file,start,duration_s,samples,missed slots,overflows,channel,"
+         "V_min,V_mean,V_max,mA_min,mA_mean,mA_max,mW_min,mW_mean,mW_max,charge_mAh,energy_Wh\n");
+  size_t found = 0;
+  for (const IndexEntry &e : entries) {
+    bool any = false;
+    for (uint8_t ch = 0; ch < e.channels && ch < MAX_CHANNELS; ch++) {
+      if (!matches(q, e, ch)) {
+        continue;
+      }
+      char start[80];
+      formatDate(e.start, start, sizeof(start));
+      const ChannelStats &s = e.ch[ch];
+      printf("%s,%s,%.6f,%llu,%llu,%llu,%u,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.6f,%.6f\n",
+             e.name, start, e.duration_s, (unsigned long long)e.samples,
+             (unsigned long long)e.missedSlots, (unsigned long long)e.overflows, ch + 1,
+             s.voltageMin, s.voltageMean, s.voltageMax, s.currentMin, s.currentMean, s.currentMax,
+             s.powerMin, s.powerMean, s.powerMax, s.charge_mAh, s.energy_Wh);
+      any = true;
+    }
+    found += any;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double millis = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+  fprintf(stderr, "%zu of %zu logfiles in %.1f ms\n", found, entries.size(), millis);
+  return 0;
+}
+
+static int usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s build DIR [-j threads]\n"
+          "       %s query DIR [--from dd/mm/yyyy[ hh:mm:ss]] [--to dd/mm/yyyy[ hh:mm:ss]]\n"
+          "                [--current-above mA] [--voltage-below V] [--min-duration s] [--overflows]\n"
+          "                [--channel N]\n",
+          program, program);
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    return usage(argv[0]);
+  }
+  const char *dir = argv[2];
+  if (!strcmp(argv[1], "build")) {
+    unsigned threads = std::thread::hardware_concurrency();
+    if (argc == 5 && !strcmp(argv[3], "-j") && atoi(argv[4]) > 0) {
+      threads = atoi(argv[4]);
+    }
+    else if (argc != 3) {
+      return usage(argv[0]);
+    }
+    return build(dir, threads);
+  }
+  if (strcmp(argv[1], "query")) {
+    return usage(argv[0]);
+  }
+
+  Query q = {NO_TIME, NO_TIME, NAN, NAN, 0, false, -1};
+  for (int i = 3; i < argc; i++) {
+    const char *option = argv[i];
+    if (!strcmp(option, "--overflows")) {
+      q.overflows = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return usage(argv[0]);
+    }
+    const char *value = argv[++i];
+    if (!strcmp(option, "--from") || !strcmp(option, "--to")) {
+      int64_t t;
+      int fields = parseDate(value, t);
+      if (!fields) {
+        fprintf(stderr, "%s: not a date dd/mm/yyyy[ hh:mm:ss]: %s\n", option, value);
+        return 2;
+      }
+      if (option[2] == 'f') {
+        q.from = t;
+      }
+      else {
+        // the end of the day or of the second given
+        q.to = t + (fields <= 3 ? 86400 : 1);
+      }
+    }
+    else if (!strcmp(option, "--current-above")) {
+      q.currentAbove = atof(value);
+    }
+    else if (!strcmp(option, "--voltage-below")) {
+      q.voltageBelow = atof(value);
+    }
+    else if (!strcmp(option, "--min-duration")) {
+      q.minDuration = atof(value);
+    }
+    else if (!strcmp(option, "--channel") && atoi(value) >= 1 && atoi(value) <= MAX_CHANNELS) {
+      q.channel = atoi(value) - 1;
+    }
+    else {
+      return usage(argv[0]);
+    }
+  }
+  return query(dir, q);
+}
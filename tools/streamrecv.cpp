@@ -0,0 +1,243 @@
+// streamrecv - receives the binary live stream of the PowerLogger (LOGGER.INI line 16) and
+// writes the samples as CSV
+//
+// Build on the host, e.g.
+//   g++ -O2 -o streamrecv tools/streamrecv.cpp src/csvformat.cpp
+//
+// Usage
+//   streamrecv /dev/ttyACM0               reads the serial port at 460800 baud, writes the CSV to stdout
+//   streamrecv /dev/ttyACM0 live.csv      writes the CSV to the given file
+//   streamrecv - < capture.bin            reads a captured stream from stdin
+//
+// The text the logger prints at power-up, before the first frame, goes to stderr. Frames
+// the logger had to drop, or which were damaged on the way, show up as gaps in the sequence
+// numbers; they are counted and reported at the end, or when the receiver is stopped with Ctrl-C.
+//
+// The columns are those of a CSV logfile, with micros() of the logger and without millis and
+// time_s. The values are formatted by src/csvformat.cpp of the firmware, i.e. they are the same
+// text as in CSV mode.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "../src/csvformat.h"
+#include "../src/streamformat.h"
+
+// the longest payload is a sample of 4 channels; anything longer is no frame
+const unsigned MAX_PAYLOAD = sizeof(StreamSample) + 4 * sizeof(StreamChannel);
+
+static volatile sig_atomic_t stopped;
+
+static void onSignal(int) {
+  stopped = 1;
+}
+
+struct Receiver {
+  FILE *out;
+  bool haveInfo;
+  StreamInfo info;
+  bool haveSequence;
+  uint16_t nextSequence;
+  unsigned long frames;
+  unsigned long samples;
+  unsigned long lost;
+  unsigned long crcErrors;
+  unsigned long beforeInfo;
+};
+
+static void printHeader(Receiver &r) {
+  if (r.info.channels == 1) {
+    fprintf(r.out, "micros,status,Load_Voltage,Current_mA, load_Power_mW\r\n");
+    return;
+  }
+  fprintf(r.out, "micros,status");
+  for (unsigned ch = 1; ch <= r.info.channels; ch++) {
+    fprintf(r.out, ",Load_Voltage_%u,Current_mA_%u, load_Power_mW_%u", ch, ch, ch);
+  }
+  fprintf(r.out, "\r\n");
+}
+
+static void handleFrame(Receiver &r, uint8_t type, uint16_t sequence, const uint8_t *payload, uint8_t length) {
+  r.frames++;
+  if (r.haveSequence && sequence != r.nextSequence) {
+    r.lost += (uint16_t)(sequence - r.nextSequence);
+  }
+  r.haveSequence = true;
+  r.nextSequence = sequence + 1;
+
+  if (type == STREAM_TYPE_INFO && length == sizeof(StreamInfo)) {
+    StreamInfo info;
+    memcpy(&info, payload, sizeof(info));
+    // same scaling as INA226_WE
+    float currentLSB_mA = info.currentRange * 1000.0f / 32768.0f;
+    if (info.channels < 1 || info.channels > 4 ||
+        !(currentLSB_mA >= FLT_MIN && currentLSB_mA <= CSV_MAX_CURRENT_LSB_MA)) {
+      return;
+    }
+    if (!r.haveInfo || info.channels != r.info.channels) {
+      r.info = info;
+      printHeader(r);
+    }
+    r.info = info;
+    r.haveInfo = true;
+    csvBegin(currentLSB_mA);
+    return;
+  }
+  if (type != STREAM_TYPE_SAMPLE) {
+    return;
+  }
+  if (!r.haveInfo) {
+    r.beforeInfo++;
+    return;
+  }
+  if (length != sizeof(StreamSample) + r.info.channels * sizeof(StreamChannel)) {
+    return;
+  }
+  StreamSample head;
+  memcpy(&head, payload, sizeof(head));
+  fprintf(r.out, "%lu,%s", (unsigned long)head.micros, head.flags ? "overflow" : "ok");
+  char values[CSV_VALUES_CHARS];
+  for (unsigned ch = 0; ch < r.info.channels; ch++) {
+    StreamChannel c;
+    memcpy(&c, payload + sizeof(head) + ch * sizeof(c), sizeof(c));
+    fwrite(values, 1, csvAppendValues(values, c.busRaw, c.shuntRaw, c.currentRaw, c.powerRaw) - values, r.out);
+  }
+  fprintf(r.out, "\r\n");
+  r.samples++;
+}
+
+// text between the frames; non-printable bytes, e.g. of a damaged frame, are left out
+static void handleText(const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (data[i] == '\n' || data[i] == '\t' || (data[i] >= 0x20 && data[i] < 0x7F)) {
+      fputc(data[i], stderr);
+    }
+  }
+}
+
+// decodes the frames in buffer; returns the number of bytes consumed, the rest is an
+// incomplete frame
+static size_t parse(Receiver &r, const uint8_t *buffer, size_t size) {
+  size_t pos = 0;
+  size_t textStart = 0;
+  while (pos + 1 < size) {
+    if (buffer[pos] != STREAM_SYNC0 || buffer[pos + 1] != STREAM_SYNC1) {
+      pos++;
+      continue;
+    }
+    if (size - pos < STREAM_FRAME_HEADER) {
+      break;
+    }
+    uint8_t type = buffer[pos + 2];
+    uint8_t length = buffer[pos + 3];
+    if (length > MAX_PAYLOAD) {
+      pos++;
+      continue;
+    }
+    size_t frameSize = STREAM_FRAME_HEADER + length + STREAM_FRAME_CRC;
+    if (size - pos < frameSize) {
+      break;
+    }
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 2; i < (size_t)STREAM_FRAME_HEADER + length; i++) {
+      crc = streamCrc(crc, buffer[pos + i]);
+    }
+    const uint8_t *crcBytes = buffer + pos + STREAM_FRAME_HEADER + length;
+    if (crc != (uint16_t)(crcBytes[0] | (crcBytes[1] << 8))) {
+      r.crcErrors++;
+      pos++;
+      continue;
+    }
+    handleText(buffer + textStart, pos - textStart);
+    uint16_t sequence = buffer[pos + 4] | (buffer[pos + 5] << 8);
+    handleFrame(r, type, sequence, buffer + pos + STREAM_FRAME_HEADER, length);
+    pos += frameSize;
+    textStart = pos;
+  }
+  // keep a possible start of a frame for the next call
+  size_t keep = pos < size && buffer[pos] == STREAM_SYNC0 ? pos : size;
+  handleText(buffer + textStart, keep - textStart);
+  return keep;
+}
+
+// raw mode at the logger's baud rate, if fd is a serial port
+static void setupSerial(int fd) {
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) {
+    return;
+  }
+  cfmakeraw(&tio);
+#ifdef B460800
+  cfsetispeed(&tio, B460800);
+  cfsetospeed(&tio, B460800);
+#endif
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr(fd, TCSANOW, &tio);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s /dev/ttyXXX|- [output.csv]\n", argv[0]);
+    return 2;
+  }
+  int fd = strcmp(argv[1], "-") ? open(argv[1], O_RDONLY | O_NOCTTY) : 0;
+  if (fd < 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  setupSerial(fd);
+  Receiver r;
+  memset(&r, 0, sizeof(r));
+  r.out = stdout;
+  if (argc == 3) {
+    r.out = fopen(argv[2], "wb");
+    if (!r.out) {
+      perror(argv[2]);
+      return 1;
+    }
+  }
+
+  // without SA_RESTART, so Ctrl-C interrupts the read and the statistics are printed
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onSignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  uint8_t buffer[4096];
+  size_t filled = 0;
+  while (!stopped) {
+    ssize_t n = read(fd, buffer + filled, sizeof(buffer) - filled);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    filled += n;
+    size_t used = parse(r, buffer, filled);
+    memmove(buffer, buffer + used, filled - used);
+    filled -= used;
+  }
+
+  fflush(r.out);
+  fprintf(stderr, "\n%lu frames, %lu samples, %lu frames lost, %lu CRC errors", r.frames, r.samples, r.lost,
+          r.crcErrors);
+  if (r.beforeInfo) {
+    fprintf(stderr, ", %lu samples before the first info frame", r.beforeInfo);
+  }
+  fprintf(stderr, "\n");
+  if (r.out != stdout) {
+    fclose(r.out);
+  }
+  if (fd != 0) {
+    close(fd);
+  }
+  return 0;
+}